@@ -0,0 +1,174 @@
+// Times compress() and decompress() stage by stage, for every predictor on
+// every image given, and prints one JSON object per line:
+//
+//   ./bench/bench images/*.ppm > results.jsonl
+//
+// Without images, a synthetic 1920x1080 one is generated. Stage times are
+// summed over tiles, MB/s are image megabytes over those times.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "compression.hpp"
+#include "instrumentation.hpp"
+
+namespace
+{
+struct predictor_case
+{
+  const char *name;
+  predictor_type predictor;
+};
+
+const predictor_case predictors[] = {
+    {"A", predictor_type::A},
+    {"B", predictor_type::B},
+    {"C", predictor_type::C},
+    {"D", predictor_type::D},
+};
+
+// smooth gradients with some noise, roughly photographic residuals
+std::string synthetic_image()
+{
+  const size_t width = 1920;
+  const size_t height = 1080;
+  bitmap<RGB> image(width, height);
+  std::mt19937 rng(1);
+  std::normal_distribution<double> noise(0, 3);
+  for (size_t y = 0; y < height; y++)
+  {
+    for (size_t x = 0; x < width; x++)
+    {
+      auto channel = [&](double v) { return uint8_t(std::min(255.0, std::max(0.0, v + noise(rng)))); };
+      image.pixel(x, y) = RGB(channel(255.0 * x / width), channel(255.0 * y / height),
+                              channel(128 + 100 * std::sin(x * 0.01) * std::cos(y * 0.013)));
+    }
+  }
+  const std::string path = "bench-synthetic.ppm";
+  image.save(path);
+  return path;
+}
+
+double megabytes(size_t bytes)
+{
+  return bytes / 1e6;
+}
+
+size_t file_size(const std::string &path)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  return in ? size_t(in.tellg()) : 0;
+}
+
+// JSON strings, for file names
+std::string quoted(const std::string &s)
+{
+  std::string q = "\"";
+  for (char c : s)
+  {
+    if (c == '"' || c == '\\')
+    {
+      q += '\\';
+    }
+    q += c;
+  }
+  return q + '"';
+}
+
+double run(const std::function<void()> &f)
+{
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  std::vector<std::string> images(argv + 1, argv + argc);
+  const bool synthetic = images.empty();
+  if (synthetic)
+  {
+    images.push_back(synthetic_image());
+  }
+  const std::string archive = "bench.blp";
+  const std::string decoded = "bench.ppm";
+
+  try
+  {
+    for (const auto &image : images)
+    {
+      size_t width = 0;
+      size_t height = 0;
+      {
+        std::ifstream in(image, std::ios::binary);
+        bitmap<RGB>::read_header(in, width, height);
+      }
+      const size_t image_bytes = width * height * sizeof(RGB);
+
+      for (const auto &p : predictors)
+      {
+        compression_settings settings;
+        settings.predictor = p.predictor;
+
+        profile times;
+        collect_profile(&times);
+        const double compress_seconds = run([&] { compress(image, archive, settings); });
+        const double decompress_seconds = run([&] { decompress(archive, decoded, settings); });
+        collect_profile(nullptr);
+        const size_t archive_bytes = file_size(archive);
+
+        std::ostringstream line;
+        line << "{\"image\":" << quoted(image) << ",\"width\":" << width << ",\"height\":" << height
+             << ",\"predictor\":\"" << p.name << "\",\"image_bytes\":" << image_bytes
+             << ",\"archive_bytes\":" << archive_bytes << ",\"ratio\":" << double(image_bytes) / archive_bytes
+             << ",\"compress_s\":" << compress_seconds << ",\"decompress_s\":" << decompress_seconds
+             << ",\"compress_MBps\":" << megabytes(image_bytes) / compress_seconds
+             << ",\"decompress_MBps\":" << megabytes(image_bytes) / decompress_seconds
+             << ",\"bits_per_symbol\":";
+        // nothing is counted with make INSTRUMENTATION=0
+        const uint64_t symbols = times.count(counter::symbols);
+        if (symbols)
+        {
+          line << double(times.count(counter::bits)) / symbols;
+        }
+        else
+        {
+          line << "null";
+        }
+        line << ",\"stages\":{";
+        for (size_t s = 0; s < stage_count; s++)
+        {
+          const double seconds = times.seconds(stage(s));
+          line << (s ? "," : "") << '"' << stage_name(stage(s)) << "\":{\"s\":" << seconds << ",\"MBps\":"
+               << (seconds > 0 ? megabytes(image_bytes) / seconds : 0) << '}';
+        }
+        line << "}}";
+        std::cout << line.str() << std::endl;
+      }
+    }
+  }
+  catch (std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::remove(archive.c_str());
+  std::remove(decoded.c_str());
+  if (synthetic)
+  {
+    std::remove(images.front().c_str());
+  }
+  return 0;
+}
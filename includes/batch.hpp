@@ -0,0 +1,32 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <string>
+#include <vector>
+
+#include "compression.hpp"
+
+struct batch_report
+{
+  size_t files = 0;
+  size_t bytes_read = 0;
+  size_t bytes_written = 0;
+  double seconds = 0;
+  std::vector<std::string> errors; // one line per file that failed
+};
+
+// Files named by source: the files of a directory that end with extension,
+// the matches of a glob pattern, or the lines of a manifest file, one path
+// per line (empty lines are skipped).
+std::vector<std::string> batch_inputs(const std::string &source, const std::string &extension);
+
+// Compresses (or decompresses) every file of source into output_directory,
+// keeping the file names with the .blp (or .ppm) extension. All files share
+// one pool: several images are coded at once, each also spreading its tiles
+// over the pool. Pixel buffers and the buffers of the entropy coders are
+// reused from one file to the next rather than allocated for each. A file
+// that fails is reported and the others go on.
+batch_report run_batch(const std::string &source, const std::string &output_directory, bool compressing,
+                       const compression_settings &settings);
+
+#endif
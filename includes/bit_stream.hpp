@@ -0,0 +1,119 @@
+#ifndef BIT_STREAM_HPP
+#define BIT_STREAM_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Packs variable length codes MSB first through a 64-bit accumulator. Bytes are
+// staged in a local buffer and appended to out in large blocks.
+class bit_writer
+{
+public:
+  explicit bit_writer(std::vector<uint8_t> &out_) : bit_writer(out_, own)
+  {
+  }
+
+  // stages in staging, which can be kept from one writer to the next
+  bit_writer(std::vector<uint8_t> &out_, std::vector<uint8_t> &staging) : out(out_), buffer(staging)
+  {
+    buffer.resize(buffer_size);
+  }
+
+  // length must be <= 32, code must fit in length bits
+  void put(uint32_t code, unsigned length)
+  {
+    accumulator = (accumulator << length) | code;
+    count += length;
+    if (count >= 32)
+    {
+      count -= 32;
+      uint32_t word = uint32_t(accumulator >> count);
+      buffer[used++] = uint8_t(word >> 24);
+      buffer[used++] = uint8_t(word >> 16);
+      buffer[used++] = uint8_t(word >> 8);
+      buffer[used++] = uint8_t(word);
+      if (used == buffer_size)
+      {
+        drain();
+      }
+    }
+  }
+
+  // pads the last byte with zeros and hands everything to the stream
+  void flush()
+  {
+    while (count >= 8)
+    {
+      count -= 8;
+      buffer[used++] = uint8_t(accumulator >> count);
+    }
+    if (count)
+    {
+      buffer[used++] = uint8_t(accumulator << (8 - count));
+      count = 0;
+    }
+    drain();
+  }
+
+private:
+  static const size_t buffer_size = 1 << 16;
+
+  void drain()
+  {
+    out.insert(out.end(), buffer.begin(), buffer.begin() + used);
+    used = 0;
+  }
+
+  std::vector<uint8_t> &out;
+  std::vector<uint8_t> own; // staging buffer, unless one is given
+  std::vector<uint8_t> &buffer;
+  size_t used = 0;
+  uint64_t accumulator = 0;
+  unsigned count = 0;
+};
+
+// Reads back what bit_writer produced, straight from memory. Reading past
+// the end yields zeros.
+class bit_reader
+{
+public:
+  bit_reader(const uint8_t *data_, size_t size_) : data(data_), size(size_)
+  {
+  }
+
+  // next n bits without consuming them, 0 < n <= 32
+  uint32_t peek(unsigned n)
+  {
+    if (count < 32)
+    {
+      refill();
+    }
+    return uint32_t(accumulator >> (count - n)) & ((uint64_t(1) << n) - 1);
+  }
+
+  // n must not exceed what the last peek looked at
+  void skip(unsigned n)
+  {
+    count -= n;
+  }
+
+private:
+  void refill()
+  {
+    while (count <= 56)
+    {
+      uint8_t b = position < size ? data[position++] : 0;
+      accumulator = (accumulator << 8) | b;
+      count += 8;
+    }
+  }
+
+  const uint8_t *data;
+  size_t size;
+  size_t position = 0;
+  uint64_t accumulator = 0;
+  unsigned count = 0;
+};
+
+#endif
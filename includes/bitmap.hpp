@@ -1,21 +1,57 @@
 #ifndef __MODULE_BITMAP__
 #define __MODULE_BITMAP__
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <string>
 #include <stdexcept>
 #include <fstream>
+#include <sstream>
+#include <type_traits>
 
+#include <buffer_pool.hpp>
 #include <pixel.hpp>
 
 ////////////////////////////////////////
+// Owned pixels come from the buffer pool: 64-byte aligned, and recycled
+// for the next bitmap of about the same size once this one is gone.
 template <typename P>
  class bitmap
   {
    private:
 
+       static_assert(std::is_trivially_copyable<P>::value,
+                     "pixels are copied and recycled as raw bytes");
+
        size_t w,h;
        P * pixels;
+       bool owned; // false for views over someone else's pixels
+
+       /////////////////////////////////
+       void allocate(size_t w_, size_t h_)
+        {
+         release();
+         w=w_;
+         h=h_;
+         pixels=static_cast<P*>(acquire_buffer(w*h*sizeof(P)));
+         owned=true;
+        }
+
+       void release()
+        {
+         if (owned)
+          release_buffer(pixels,w*h*sizeof(P));
+         pixels=nullptr;
+        }
+
+       struct no_initialisation {};
+
+       bitmap(size_t w_, size_t h_, no_initialisation)
+        : w(0),h(0),pixels(nullptr),owned(true)
+        {
+         allocate(w_,h_);
+        }
 
    public:
 
@@ -28,6 +64,8 @@ template <typename P>
        P & pixel(size_t x, size_t y) { return pixels[y*w+x]; }
        const P & linear_pixel(size_t o) const {return pixels[o]; }
        P & linear_pixel(size_t o) { return pixels[o]; }
+       const P * data() const { return pixels; }
+       P * data() { return pixels; }
 
        //////////////////////////////////
        const P & pixel(int x, int y, bool) const
@@ -38,47 +76,77 @@ template <typename P>
         }
 
        /////////////////////////////////
+       // new owned storage, the pixels are not initialised
        void resize(size_t w_, size_t h_)
         {
-         delete pixels; // ok if ==nullptr;
-         w=w_;
-         h=h_;
-         pixels=new P[w*h];
+         allocate(w_,h_);
         }
 
        /////////////////////////////////
-       void load(const std::string & filename)
+       // for pixels that are all written before being read: skips
+       // clearing them, and so touching every page of the block upfront
+       static bitmap uninitialised(size_t w_, size_t h_)
         {
-         std::ifstream in(filename,std::ios::binary);
+         return bitmap(w_,h_,no_initialisation());
+        }
 
-         if (in)
+       /////////////////////////////////
+       // parses a P6 header, leaves in on the first pixel byte
+       static void read_header(std::istream & in, size_t & w_, size_t & h_)
+        {
+         std::string tag;
+         in >> tag;
+         if (tag=="P6")
           {
-           std::string tag;
-           in >> tag;
-           if (tag=="P6")
+           int levels;
+
+           in >> w_ >> h_ >> levels;
+           if (levels==255)
             {
-             size_t t_w,t_h;
-             int levels;
-
-             in >> t_w >> t_h >> levels;
-             if (levels==255)
-              {
-               w=t_w;
-               h=t_h;
-               delete[] pixels;
-
-               pixels=new P[w*h];
-
-               // if =='\n', all is good
-               if (in.get()=='\r')
-                in.get(); // \n
-               in.read((char*)pixels, w*h*sizeof(P));
-              }
-             else
-              throw std::runtime_error("unsupported depth "+levels);
+             // if =='\n', all is good
+             if (in.get()=='\r')
+              in.get(); // \n
             }
            else
-            throw std::runtime_error("unsupported format "+tag);
+            throw std::runtime_error("unsupported depth "+std::to_string(levels));
+          }
+         else
+          throw std::runtime_error("unsupported format "+tag);
+        }
+
+       /////////////////////////////////
+       // same for a PPM already in memory, returns where the pixels start
+       static size_t read_header(const uint8_t * data, size_t size, size_t & w_, size_t & h_)
+        {
+         // the header is a few dozen bytes at most
+         std::istringstream in(std::string((const char*)data, std::min<size_t>(size, 256)));
+         read_header(in, w_, h_);
+
+         std::streamoff offset=in.tellg();
+         if (!in || offset<0 || (w_ && (size-offset)/sizeof(P)/w_<h_))
+          throw std::runtime_error("truncated image");
+         return offset;
+        }
+
+       /////////////////////////////////
+       static std::string header(size_t w_, size_t h_)
+        {
+         return "P6 "+std::to_string(w_)+' '+std::to_string(h_)+" 255\xa";
+        }
+
+       /////////////////////////////////
+       void load(const std::string & filename)
+        {
+         std::ifstream in(filename,std::ios::binary);
+
+         if (in)
+          {
+           size_t t_w,t_h;
+           read_header(in,t_w,t_h);
+
+           allocate(t_w,t_h);
+
+           in.read((char*)pixels, w*h*sizeof(P));
           }
          else
           throw std::runtime_error("can't open "+filename+" for reading");
@@ -91,7 +159,7 @@ template <typename P>
 
          if (out)
           {
-           out << "P6 " << w << ' ' << h << " 255\xa";
+           out << header(w,h);
            out.write((const char*)pixels,w*h*sizeof(P));
           }
          else
@@ -102,43 +170,76 @@ template <typename P>
     {
      if (&other!=this)
       {
-       delete[] pixels;
+       allocate(other.w,other.h);
+       std::copy(other.pixels,other.pixels+w*h,pixels);
+      }
+
+     return *this;
+    }
+
+   // takes the pixels over, views stay views; other is left empty
+   bitmap & operator=(bitmap && other) noexcept
+    {
+     if (&other!=this)
+      {
+       release();
        w=other.w;
        h=other.h;
-       pixels=new P[w*h];
-       for (size_t i=0;i<w*h;i++)
-        pixels[i]=other.pixels[i];
+       pixels=other.pixels;
+       owned=other.owned;
+       other.w=other.h=0;
+       other.pixels=nullptr;
+       other.owned=true;
       }
 
      return *this;
     }
 
    bitmap()
-    : w(0),h(0),pixels(nullptr)
+    : w(0),h(0),pixels(nullptr),owned(true)
     {}
 
+   // cleared pixels, see uninitialised()
    bitmap(size_t w_, size_t h_)
+    : bitmap(w_,h_,no_initialisation())
+    {
+     std::fill(pixels,pixels+w*h,P());
+    }
+
+   // view over w_*h_ pixels owned by the caller (e.g. a band of rows
+   // of a bigger bitmap), which must outlive it
+   bitmap(size_t w_, size_t h_, P * pixels_)
     : w(w_),
       h(h_),
-      pixels(new P[w*h])
+      pixels(pixels_),
+      owned(false)
     {}
 
    bitmap(const std::string & filename)
-    : pixels(nullptr)
+    : w(0),h(0),pixels(nullptr),owned(true)
     {
      load(filename);
     }
 
+   // a copy always owns its pixels, even the copy of a view
    bitmap(const bitmap & other)
-    : w(other.width()),
-      h(other.height()),
-      pixels(new P[w*h])
+    : bitmap(other.w,other.h,no_initialisation())
+    {
+     std::copy(other.pixels,other.pixels+w*h,pixels);
+    }
+
+   bitmap(bitmap && other) noexcept
+    : w(other.w),
+      h(other.h),
+      pixels(other.pixels),
+      owned(other.owned)
     {
-     for (size_t i=0;i<w*h;i++)
-      pixels[i]=other.pixels[i];
+     other.w=other.h=0;
+     other.pixels=nullptr;
+     other.owned=true;
     }
 
-   ~bitmap() { delete[] pixels; }
+   ~bitmap() { release(); }
   };
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+
+#include "codec_api.hpp"
+
+// Pixel storage of bitmaps: 64-byte aligned blocks, left uninitialised, and
+// kept once released so that the next image of the same size (the next tile,
+// the next file of a batch) reuses their pages instead of faulting in new
+// ones. Sizes are rounded up to classes of at most 1/8 more. Large blocks
+// are advised to use transparent huge pages, unless built with
+// CODEC_NO_HUGE_PAGES (make HUGE_PAGES=0). Thread safe.
+const size_t buffer_alignment = 64;
+
+void *acquire_buffer(size_t bytes);
+
+// bytes as given to acquire_buffer
+void release_buffer(void *buffer, size_t bytes);
+
+// Frees every block kept for reuse, e.g. when a long running program is
+// done with large images. At most max_kept_buffer_bytes are kept anyway.
+CODEC_API void trim_buffers();
+
+const size_t max_kept_buffer_bytes = size_t(512) << 20;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef CODEC_API_HPP
+#define CODEC_API_HPP
+
+// Marks the entry points of liblossless-codec. The library objects are built
+// with -fvisibility=hidden, so nothing else is exported from the shared one.
+#define CODEC_API __attribute__((visibility("default")))
+
+#endif
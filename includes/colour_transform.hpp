@@ -0,0 +1,21 @@
+#ifndef COLOUR_TRANSFORM_HPP
+#define COLOUR_TRANSFORM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+enum class colour_transform
+{
+  none,
+  rct,  // JPEG 2000 reversible colour transform
+  ycocg // YCoCg-R
+};
+
+// Lossless colour decorrelation of count interleaved RGB pixels, in place.
+// Both transforms are written as lifting steps on bytes modulo 256, with the
+// differences read as signed bytes, so they invert exactly whatever the
+// input and keep the 8-bit channels the predictors expect.
+void forward_transform(colour_transform transform, uint8_t *pixels, size_t count);
+void inverse_transform(colour_transform transform, uint8_t *pixels, size_t count);
+
+#endif
@@ -1,9 +1,66 @@
 #ifndef COMPRESSION_HPP
 #define COMPRESSION_HPP
 
-#include "options.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
 
-void compress(const std::string &filepath, const std::string &archivepath, predictor_type predictor);
-void decompress(const std::string &archivepath, const std::string &filepath);
+#include "codec_api.hpp"
+#include "colour_transform.hpp"
+#include "entropy.hpp"
+#include "predictors.hpp"
+
+// Every function below throws std::invalid_argument for settings out of
+// range.
+struct compression_settings
+{
+  predictor_type predictor = predictor_type::A;
+  entropy_type entropy = entropy_type::huffman;
+  colour_transform transform = colour_transform::none;
+  size_t bands = 1;   // Huffman tables per channel (1 to 9), by recent residual magnitude
+  size_t tiles = 1;   // row strips coded independently, at least 1
+  size_t threads = 0; // 0 uses every core
+  size_t passes = 0;  // decodes only this many predictor B passes (at most 4), 0 for all
+  bool stream = false; // row by row in O(width) memory, predictors A, C and D
+};
+
+class thread_pool;
+
+CODEC_API void compress(const std::string &filepath, const std::string &archivepath,
+                        const compression_settings &settings);
+CODEC_API void decompress(const std::string &archivepath, const std::string &filepath,
+                          const compression_settings &settings = compression_settings());
+
+// same, on a pool shared with other work (settings.threads is ignored)
+CODEC_API void compress(const std::string &filepath, const std::string &archivepath,
+                        const compression_settings &settings, thread_pool &pool);
+CODEC_API void decompress(const std::string &archivepath, const std::string &filepath,
+                          const compression_settings &settings, thread_pool &pool);
+
+// In memory, for programs linking liblossless-codec. Pixels are 8-bit RGB
+// rows of width pixels, stride bytes apart (0 for width * 3). The archives
+// are the same as the files of compress(); settings.stream is ignored.
+CODEC_API std::vector<uint8_t> compress_pixels(const uint8_t *pixels, size_t width, size_t height, size_t stride,
+                                               const compression_settings &settings);
+CODEC_API std::vector<uint8_t> compress_ppm(const uint8_t *ppm, size_t size, const compression_settings &settings);
+
+// Size of the image decompress_pixels() writes, the preview one when
+// settings.passes is set.
+CODEC_API void archive_dimensions(const uint8_t *archive, size_t size, size_t &width, size_t &height,
+                                  const compression_settings &settings = compression_settings());
+CODEC_API void decompress_pixels(const uint8_t *archive, size_t size, uint8_t *pixels, size_t stride,
+                                 const compression_settings &settings = compression_settings());
+CODEC_API std::vector<uint8_t> decompress_ppm(const uint8_t *archive, size_t size,
+                                              const compression_settings &settings = compression_settings());
+
+CODEC_API std::vector<uint8_t> compress_pixels(const uint8_t *pixels, size_t width, size_t height, size_t stride,
+                                               const compression_settings &settings, thread_pool &pool);
+CODEC_API std::vector<uint8_t> compress_ppm(const uint8_t *ppm, size_t size, const compression_settings &settings,
+                                            thread_pool &pool);
+CODEC_API void decompress_pixels(const uint8_t *archive, size_t size, uint8_t *pixels, size_t stride,
+                                 const compression_settings &settings, thread_pool &pool);
+CODEC_API std::vector<uint8_t> decompress_ppm(const uint8_t *archive, size_t size,
+                                              const compression_settings &settings, thread_pool &pool);
 
 #endif
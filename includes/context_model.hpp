@@ -0,0 +1,44 @@
+#ifndef CONTEXT_MODEL_HPP
+#define CONTEXT_MODEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "range_coder.hpp"
+
+// CALIC style modelling of predictor A. Each channel is predicted by
+// prediction_a, corrected by the mean error seen so far in its texture and
+// activity context (bias cancellation), and the residual is range coded with
+// a model chosen by the quantised activity: gradients, the error at W and
+// the error of the previous channel of the same pixel.
+//
+// Rows are interleaved RGB channel bytes. above2 and above are the two rows
+// before the current one (any content when y < 2, they are not read).
+// Coding is sequential within a tile since every context depends on the
+// pixels just before.
+class context_model
+{
+public:
+  static const size_t activity_levels = 8;
+  static const size_t texture_patterns = 256;
+
+  void encode_row(range_encoder &rc, const uint8_t *above2, const uint8_t *above, const uint8_t *current, size_t y,
+                  size_t width);
+  void decode_row(range_decoder &rc, const uint8_t *above2, const uint8_t *above, uint8_t *current, size_t y,
+                  size_t width);
+
+private:
+  struct bias
+  {
+    int sum = 0;
+    int count = 0;
+  };
+
+  template <typename Code>
+  void code_row(const uint8_t *above2, const uint8_t *above, uint8_t *current, size_t y, size_t width, Code code);
+
+  byte_model models[3 * activity_levels];
+  bias biases[3 * (activity_levels / 2) * texture_patterns];
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef CPU_DISPATCH_HPP
+#define CPU_DISPATCH_HPP
+
+// Runtime choice of the instruction set of the vector kernels. Most of them
+// are plain loops that the compiler vectorises; as the build targets the
+// baseline x86-64 (SSE2), the same loop is compiled again for SSSE3 (byte
+// shuffles for the strided RGB loads) and AVX2, and the widest the CPU runs
+// is picked once at startup. Kernels written with intrinsics are picked the
+// same way.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_DISPATCH_X86
+#endif
+
+// ordered: each one implies those before it
+enum class instruction_set
+{
+  generic,
+  ssse3,
+  sse41,
+  avx2
+};
+
+inline instruction_set detect_instruction_set()
+{
+#ifdef CPU_DISPATCH_X86
+  // may run before the constructors that would otherwise do it
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return instruction_set::avx2;
+  }
+  if (__builtin_cpu_supports("sse4.1"))
+  {
+    return instruction_set::sse41;
+  }
+  if (__builtin_cpu_supports("ssse3"))
+  {
+    return instruction_set::ssse3;
+  }
+#endif
+  return instruction_set::generic;
+}
+
+inline bool cpu_supports(instruction_set set)
+{
+  static const instruction_set best = detect_instruction_set();
+  return set <= best;
+}
+
+template <typename signature, signature *body> struct plain_kernel;
+
+// Builds of the plain loop body, which should be always_inline so that it is
+// vectorised again in each of them.
+template <typename... arguments, void (*body)(arguments...)> struct plain_kernel<void(arguments...), body>
+{
+  typedef void (*kernel)(arguments...);
+
+  static void generic(arguments... a)
+  {
+    body(a...);
+  }
+
+#ifdef CPU_DISPATCH_X86
+  __attribute__((target("ssse3"))) static void ssse3(arguments... a)
+  {
+    body(a...);
+  }
+
+  __attribute__((target("avx2"))) static void avx2(arguments... a)
+  {
+    body(a...);
+  }
+#endif
+
+  static kernel select()
+  {
+#ifdef CPU_DISPATCH_X86
+    if (cpu_supports(instruction_set::avx2))
+    {
+      return avx2;
+    }
+    if (cpu_supports(instruction_set::ssse3))
+    {
+      return ssse3;
+    }
+#endif
+    return generic;
+  }
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __MODULE_ENTROPY__
+#define __MODULE_ENTROPY__
+
+enum class entropy_type
+  {
+   huffman,    // table statique, deux passes
+   range,      // codeur arithmétique adaptatif, une passe
+   context     // contextes et correction de biais à la CALIC, prédicteur A
+  };
+
+#endif
+ // __MODULE_ENTROPY__
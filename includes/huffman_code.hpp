@@ -0,0 +1,251 @@
+#ifndef HUFFMAN_CODE_HPP
+#define HUFFMAN_CODE_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "bit_stream.hpp"
+#include "huffman_tree.hpp"
+
+// Canonical Huffman code over 8-bit symbols. Only the code lengths are taken
+// from the tree, codes are then reassigned in (length, symbol) order so the
+// encoder is a flat table lookup and the decoder only needs counts per length.
+// Codes are at most max_code_length bits, both when they are built and when
+// they are read back, so one table probe always decodes a symbol.
+class huffman_code
+{
+public:
+  static const size_t symbol_count = 256;
+  static const unsigned max_code_length = 12;
+
+  struct entry
+  {
+    uint32_t code;
+    uint8_t length;
+  };
+
+  typedef huffman_tree_factory<uint8_t>::huffman_tree huffman_tree;
+
+  // no symbols, only there to be assigned
+  huffman_code() = default;
+
+  explicit huffman_code(const huffman_tree &ht)
+  {
+    uint8_t symbols[symbol_count];
+    uint8_t lengths[symbol_count];
+    size_t count = 0;
+    for (auto &l : ht.get_leaves())
+    {
+      if (l.code_length > max_code_length)
+      {
+        throw std::runtime_error("Huffman code too long.");
+      }
+      symbols[count] = l.symbol;
+      lengths[count++] = l.code_length;
+    }
+    assign(symbols, lengths, count);
+  }
+
+  // from code lengths alone, which must form a prefix code. A lone symbol
+  // has length 0.
+  huffman_code(const uint8_t *symbols, const uint8_t *lengths, size_t count)
+  {
+    assign(symbols, lengths, count);
+  }
+
+  const entry &operator[](uint8_t symbol) const
+  {
+    return table[symbol];
+  }
+
+  // number of symbols that have a code
+  size_t size() const
+  {
+    return symbols_used;
+  }
+
+  // i-th symbol in canonical order, i < size()
+  uint8_t symbol(size_t i) const
+  {
+    return sorted_symbols[i];
+  }
+
+private:
+  void assign(const uint8_t *symbols, const uint8_t *lengths, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      table[symbols[i]].length = lengths[i];
+    }
+    symbols_used = count;
+
+    uint32_t counts[max_code_length + 1] = {};
+    for (size_t s = 0; s < symbol_count; s++)
+    {
+      counts[table[s].length]++;
+    }
+    counts[0] = 0;
+
+    // first code of each length, then hand them out in symbol order
+    uint32_t next[max_code_length + 1] = {};
+    uint32_t code = 0;
+    for (unsigned l = 1; l <= max_code_length; l++)
+    {
+      code = (code + counts[l - 1]) << 1;
+      next[l] = code;
+    }
+
+    size_t offsets[max_code_length + 1] = {};
+    for (unsigned l = 1; l < max_code_length; l++)
+    {
+      offsets[l + 1] = offsets[l] + counts[l];
+    }
+    for (size_t s = 0; s < symbol_count; s++)
+    {
+      unsigned l = table[s].length;
+      if (l)
+      {
+        table[s].code = next[l]++;
+        sorted_symbols[offsets[l]++] = s;
+      }
+    }
+    if (symbols_used == 1)
+    {
+      sorted_symbols[0] = symbols[0];
+    }
+  }
+
+  entry table[symbol_count] = {};
+  uint8_t sorted_symbols[symbol_count] = {};
+  size_t symbols_used = 0;
+};
+
+// Table driven decoder for a huffman_code. The table is indexed by the next
+// max_code_length bits of the stream, so every code fits in one probe.
+class huffman_decoder
+{
+public:
+  static const unsigned table_bits = huffman_code::max_code_length;
+
+  struct entry
+  {
+    uint8_t symbol;
+    uint8_t length; // 0 when the code has a single symbol
+  };
+
+  // no code, only there to be assigned
+  huffman_decoder() = default;
+
+  explicit huffman_decoder(const huffman_code &code)
+  {
+    assign(code);
+  }
+
+  // Refills the table in place, for decoders kept from one stream to the
+  // next. Bits that start no code only come from corrupted archives, they
+  // consume the whole table width so decoding ends.
+  void assign(const huffman_code &code)
+  {
+    table.assign(size_t(1) << table_bits, entry{0, table_bits});
+    for (size_t i = 0; i < code.size(); i++)
+    {
+      uint8_t s = code.symbol(i);
+      unsigned l = code[s].length;
+      size_t first = size_t(code[s].code) << (table_bits - l);
+      for (size_t k = first; k < first + (size_t(1) << (table_bits - l)); k++)
+      {
+        table[k].symbol = s;
+        table[k].length = l;
+      }
+    }
+  }
+
+  // the code starting the table_bits bits of index
+  const entry &lookup(size_t index) const
+  {
+    return table[index];
+  }
+
+  uint8_t decode(bit_reader &bits) const
+  {
+    const entry &e = table[bits.peek(table_bits)];
+    bits.skip(e.length);
+    return e.symbol;
+  }
+
+private:
+  std::vector<entry> table;
+};
+
+// Decodes a whole pixel, one residual per channel table, in one probe when
+// the three codes fit in table_bits bits, which is the common case for
+// small residuals. The entries chain the channel tables: the green code is
+// looked up in the bits the red one leaves, and so on.
+class huffman_pixel_decoder
+{
+public:
+  static const unsigned table_bits = huffman_decoder::table_bits;
+
+  // no tables, only there to be assigned
+  huffman_pixel_decoder() = default;
+
+  explicit huffman_pixel_decoder(const huffman_decoder *channels_)
+  {
+    assign(channels_);
+  }
+
+  // refills the table in place, like huffman_decoder::assign
+  void assign(const huffman_decoder *channels_)
+  {
+    channels = channels_;
+    table.resize(size_t(1) << table_bits);
+    const size_t mask = table.size() - 1;
+    for (size_t k = 0; k < table.size(); k++)
+    {
+      entry &e = table[k];
+      e = entry();
+      const huffman_decoder::entry &first = channels[0].lookup(k);
+      e.symbols[0] = first.symbol;
+      e.count = 1;
+      e.length = first.length;
+      // the next code is only known if it ends within the bits of k
+      while (e.count < 3)
+      {
+        const huffman_decoder::entry &n = channels[e.count].lookup((k << e.length) & mask);
+        if (e.length + n.length > table_bits)
+        {
+          break;
+        }
+        e.symbols[e.count++] = n.symbol;
+        e.length += n.length;
+      }
+    }
+  }
+
+  void decode(bit_reader &bits, uint8_t *pixel) const
+  {
+    const entry &e = table[bits.peek(table_bits)];
+    pixel[0] = e.symbols[0];
+    pixel[1] = e.symbols[1];
+    pixel[2] = e.symbols[2];
+    bits.skip(e.length);
+    for (size_t c = e.count; c < 3; c++)
+    {
+      pixel[c] = channels[c].decode(bits);
+    }
+  }
+
+private:
+  struct entry
+  {
+    uint8_t symbols[3] = {};
+    uint8_t count = 0;
+    uint8_t length = 0; // bits consumed by all the symbols
+  };
+
+  const huffman_decoder *channels = nullptr; // red, green and blue
+  std::vector<entry> table;
+};
+
+#endif
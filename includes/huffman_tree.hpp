@@ -1,215 +1,209 @@
 #ifndef HUFFMAN_TREE
 #define HUFFMAN_TREE
 
+#include <algorithm>
 #include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
 
+// Counts symbol frequencies and builds Huffman code lengths from them. The
+// frequencies are a flat table indexed by symbol, so P is at most 16 bits.
 template <typename P> class huffman_tree_factory
 {
 public:
+  static_assert(sizeof(P) <= 2, "Huffman symbols are at most 16 bits.");
+  static const size_t symbol_count = size_t(1) << (CHAR_BIT * sizeof(P));
+
+  // Code lengths of the symbols that occur. The tree only exists while it
+  // is built, as one array of nodes; nothing is allocated per node.
   class huffman_tree
   {
   public:
-    class node
+    struct leaf
     {
-    private:
-      P symbol = P();
-      unsigned frequency = 1;
-      unsigned depth = 0;
-      unsigned code = 0;
-      node *left = NULL;
-      node *right = NULL;
-
-      void update_children(bool direction)
-      {
-        code <<= 1;
-        code |= direction & 1;
-        depth++;
-
-        if (left)
-        {
-          left->update_children(direction);
-        }
-        if (right)
-        {
-          right->update_children(direction);
-        }
-      }
-
-    public:
-      bool is_leaf() const
-      {
-        return (left == NULL) && (right == NULL);
-      }
-
-      const node *get_child(bool direction) const
-      {
-        if (direction)
-        {
-          return right;
-        }
-        else
-        {
-          return left;
-        }
-      }
-
-      void inc_frequency()
-      {
-        frequency++;
-      }
-
-      P get_symbol() const
-      {
-        return symbol;
-      }
+      P symbol;
+      uint64_t frequency;
+      unsigned code_length;
+    };
 
-      void set_frequency(unsigned f)
+    // leaves in symbol order, lengths are filled in here. No code is longer
+    // than max_length bits, which must leave room for every leaf.
+    huffman_tree(std::vector<leaf> leaves_, unsigned max_length) : leaves(std::move(leaves_))
+    {
+      if (max_length < CHAR_BIT * sizeof(size_t) && (size_t(1) << max_length) < leaves.size())
       {
-        frequency = f;
+        throw std::invalid_argument("Too many symbols for the Huffman code length limit.");
       }
 
-      unsigned get_frequency() const
+      // by frequency, ties in symbol order
+      std::vector<uint32_t> order(leaves.size());
+      for (size_t i = 0; i < order.size(); i++)
       {
-        return frequency;
+        order[i] = i;
       }
+      std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return leaves[a].frequency != leaves[b].frequency ? leaves[a].frequency < leaves[b].frequency : a < b;
+      });
 
-      unsigned get_code_length() const
+      if (merge(order) > max_length)
       {
-        return depth;
+        package_merge(order, max_length);
       }
+    }
 
-      unsigned get_code() const
-      {
-        return code;
-      }
+    const std::vector<leaf> &get_leaves() const
+    {
+      return leaves;
+    }
 
-      node(P symbol_) : symbol(symbol_)
-      {
-      }
+  private:
+    struct node
+    {
+      uint64_t frequency;
+      uint32_t link; // parent while merging, depth afterwards
+    };
 
-      node(node *left_, node *right_) : left(left_), right(right_)
+    // Two queues: the sorted leaves, and the merged nodes, which come out of
+    // the merges already sorted. Leaves win ties. Returns the longest code.
+    unsigned merge(const std::vector<uint32_t> &order)
+    {
+      const size_t n = order.size();
+      std::vector<node> nodes(2 * n - 1);
+      for (size_t i = 0; i < n; i++)
       {
-        frequency = left->get_frequency() + right->get_frequency();
-        left->update_children(0);
-        right->update_children(1);
+        nodes[i].frequency = leaves[order[i]].frequency;
       }
 
-      ~node()
+      size_t next_leaf = 0;
+      size_t next_merged = n;
+      for (size_t m = n; m < nodes.size(); m++)
       {
-        if (left)
-        {
-          delete left;
-        }
-        if (right)
+        size_t children[2];
+        for (auto &c : children)
         {
-          delete right;
+          if (next_leaf < n && (next_merged == m || nodes[next_leaf].frequency <= nodes[next_merged].frequency))
+          {
+            c = next_leaf++;
+          }
+          else
+          {
+            c = next_merged++;
+          }
         }
+        nodes[m].frequency = nodes[children[0]].frequency + nodes[children[1]].frequency;
+        nodes[children[0]].link = m;
+        nodes[children[1]].link = m;
       }
-    };
 
-    huffman_tree(std::map<P, node *> symbol_node) : leaves(symbol_node)
-    {
-      std::multimap<unsigned, node *> frequency_nodes;
-      for (auto &p : symbol_node)
+      // parents come after their children, the root last
+      unsigned longest = 0;
+      nodes.back().link = 0;
+      for (size_t m = nodes.size() - 1; m-- > 0;)
       {
-        node *n = p.second;
-        frequency_nodes.insert(std::pair<unsigned, node *>(n->get_frequency(), n));
+        nodes[m].link = nodes[nodes[m].link].link + 1;
       }
-
-      while (frequency_nodes.size() > 1)
+      for (size_t i = 0; i < n; i++)
       {
-        auto it = frequency_nodes.begin();
-        node *l = it->second;
-        frequency_nodes.erase(it);
-        it = frequency_nodes.begin();
-        node *r = it->second;
-        frequency_nodes.erase(it);
-
-        node *n = new node(l, r);
-        frequency_nodes.insert(std::pair<unsigned, node *>(n->get_frequency(), n));
+        leaves[order[i]].code_length = nodes[i].link;
+        longest = std::max(longest, nodes[i].link);
       }
-      root = frequency_nodes.begin()->second;
+      return longest;
     }
 
-    ~huffman_tree()
+    // Package-merge, for when the tree is too deep. Starting from the
+    // deepest level, each level's list merges the leaves with the pairs of
+    // the level below. The first 2n - 2 items of the top list are the
+    // cheapest, and a leaf's length is the number of levels whose selected
+    // prefix holds it. Those prefixes only need to know which items were
+    // leaves, so the lists keep weights and one flag per item.
+    void package_merge(const std::vector<uint32_t> &order, unsigned max_length)
     {
-      delete root;
-    }
-
-    friend std::ostream &operator<<(std::ostream &os, const huffman_tree &ht)
-    {
-      for (auto &p : ht.get_leaves())
+      const size_t n = order.size();
+      const size_t stride = 2 * n;
+      std::vector<uint64_t> list(n);
+      std::vector<uint64_t> merged;
+      merged.reserve(stride);
+      std::vector<uint8_t> is_leaf(max_length * stride, 1);
+
+      for (size_t i = 0; i < n; i++)
       {
-        node *n = p.second;
-        unsigned code = n->get_code();
-
-        os << (unsigned)p.first << ' ';
-        for (size_t i = 0; i < n->get_code_length(); i++)
+        list[i] = leaves[order[i]].frequency;
+      }
+      for (size_t level = max_length - 1; level-- > 0;)
+      {
+        const size_t pairs = list.size() / 2;
+        size_t i = 0;
+        size_t j = 0;
+        merged.clear();
+        while (i < n || j < pairs)
         {
-          if (code & 1)
+          const bool leaf = j == pairs || (i < n && leaves[order[i]].frequency <= list[2 * j] + list[2 * j + 1]);
+          is_leaf[level * stride + merged.size()] = leaf;
+          if (leaf)
           {
-            os << '1';
+            merged.push_back(leaves[order[i++]].frequency);
           }
           else
           {
-            os << '0';
+            merged.push_back(list[2 * j] + list[2 * j + 1]);
+            j++;
           }
-          code >>= 1;
         }
-        os << std::endl;
+        std::swap(list, merged);
       }
-      return os;
-    }
-
-    std::map<P, node *> get_leaves() const
-    {
-      return leaves;
-    }
 
-    const node &get_leaf(P symbol) const
-    {
-      return *get_leaves()[symbol];
-    }
-
-    const node *get_root() const
-    {
-      return root;
+      for (auto &l : leaves)
+      {
+        l.code_length = 0;
+      }
+      size_t selected = 2 * n - 2;
+      for (size_t level = 0; level < max_length && selected; level++)
+      {
+        size_t leaf_count = std::count(&is_leaf[level * stride], &is_leaf[level * stride] + selected, 1);
+        for (size_t i = 0; i < leaf_count; i++)
+        {
+          leaves[order[i]].code_length++;
+        }
+        selected = 2 * (selected - leaf_count);
+      }
     }
 
-  private:
-    node *root;
-    std::map<P, node *> leaves;
+    std::vector<leaf> leaves;
   };
 
-  void inc_frequency(P symbol)
+  huffman_tree_factory() : frequencies(symbol_count)
   {
-    if (symbol_node[symbol])
-    {
-      symbol_node[symbol]->inc_frequency();
-    }
-    else
-    {
-      symbol_node[symbol] = new huffman_tree_node(symbol);
-    }
   }
 
-  void set_frequency(P symbol, unsigned frequency)
+  // a frequency of 0 leaves the symbol out of the code
+  void set_frequency(P symbol, uint64_t frequency)
   {
-    if (!symbol_node[symbol])
-    {
-      symbol_node[symbol] = new huffman_tree_node(symbol);
-    }
-    symbol_node[symbol]->set_frequency(frequency);
+    frequencies[symbol] = frequency;
+  }
+
+  bool empty() const
+  {
+    return std::all_of(frequencies.begin(), frequencies.end(), [](uint64_t f) { return f == 0; });
   }
 
-  huffman_tree *create()
+  // needs at least one symbol
+  huffman_tree create(unsigned max_length = UINT_MAX) const
   {
-    return new huffman_tree(symbol_node);
+    std::vector<typename huffman_tree::leaf> leaves;
+    for (size_t s = 0; s < symbol_count; s++)
+    {
+      if (frequencies[s])
+      {
+        leaves.push_back({P(s), frequencies[s], 0});
+      }
+    }
+    return huffman_tree(std::move(leaves), max_length);
   }
 
 private:
-  typedef typename huffman_tree_factory<P>::huffman_tree::node huffman_tree_node;
-  std::map<P, huffman_tree_node *> symbol_node;
+  std::vector<uint64_t> frequencies; // 64 bits, a large tile overflows 32
 };
 
 #endif
@@ -0,0 +1,182 @@
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Timers and counters of the codec. They only record while a profile is
+// collected, and compile to nothing with CODEC_NO_INSTRUMENTATION (make
+// INSTRUMENTATION=0), where profiles stay empty.
+
+// Stages of compress() and decompress(), for timing where the work goes.
+enum class stage
+{
+  load,           // mapping the input and parsing its header
+  prediction,     // colour transform, predictor choice and residuals
+  histogram,      // Huffman frequencies
+  tree,           // Huffman code lengths and tables
+  packing,        // entropy coding of the residuals
+  write,          // archive or image output
+  decode,         // code tables and entropy decoding
+  reconstruction, // pixels from residuals, inverse colour transform
+};
+
+const size_t stage_count = size_t(stage::reconstruction) + 1;
+
+const char *stage_name(stage s);
+
+enum class counter
+{
+  bits,          // entropy coded bits written, or read when decoding
+  symbols,       // residuals coded or decoded
+  bytes_read,    // input image or archive
+  bytes_written, // archive or output image
+};
+
+const size_t counter_count = size_t(counter::bytes_written) + 1;
+
+// What the timers and counters add up while this is collected. Stage times
+// are summed over tiles: parallel tiles add up to more than the wall time.
+class profile
+{
+public:
+  struct event
+  {
+    stage s;
+    uint32_t thread;
+    uint64_t begin; // nanoseconds since the profile was created
+    uint64_t duration;
+  };
+
+  // with tracing, every timed scope is also kept as an event
+  explicit profile(bool tracing_ = false);
+
+  double seconds(stage s) const
+  {
+    return nanoseconds[size_t(s)] * 1e-9;
+  }
+
+  uint64_t count(counter c) const
+  {
+    return counts[size_t(c)];
+  }
+
+  // stage times, counters and rates, for humans
+  void print_summary(std::ostream &out) const;
+
+  // Chrome trace event JSON (chrome://tracing, Perfetto)
+  void write_trace(std::ostream &out) const;
+
+  void add(stage s, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+  void add(counter c, uint64_t n)
+  {
+    counts[size_t(c)] += n;
+  }
+
+private:
+  std::atomic<uint64_t> nanoseconds[stage_count];
+  std::atomic<uint64_t> counts[counter_count];
+  std::chrono::steady_clock::time_point created;
+  bool tracing;
+  mutable std::mutex mutex;
+  std::vector<event> events;
+};
+
+// Where the timers and counters add up from now on, nullptr (the default)
+// to stop. Only one collector at a time, for the whole process.
+void collect_profile(profile *p);
+profile *collected_profile();
+
+// Most bytes of bitmap pixels (buffer pool blocks) in use at once since the
+// program started, the bulk of the codec's memory. 0 when not counted.
+size_t peak_buffer_bytes();
+
+#ifndef CODEC_NO_INSTRUMENTATION
+
+// Adds the time until the end of the scope to its stage. Costs one atomic
+// load when nothing is collected.
+class stage_timer
+{
+public:
+  explicit stage_timer(stage s_) : target(collected_profile()), s(s_)
+  {
+    if (target)
+    {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~stage_timer()
+  {
+    stop();
+  }
+
+  // ends the stage before the end of the scope
+  void stop()
+  {
+    if (target)
+    {
+      target->add(s, start, std::chrono::steady_clock::now());
+      target = nullptr;
+    }
+  }
+
+  stage_timer(const stage_timer &) = delete;
+  stage_timer &operator=(const stage_timer &) = delete;
+
+private:
+  profile *target;
+  stage s;
+  std::chrono::steady_clock::time_point start;
+};
+
+inline void count(counter c, uint64_t n)
+{
+  if (profile *p = collected_profile())
+  {
+    p->add(c, n);
+  }
+}
+
+void note_buffer_acquired(size_t bytes);
+void note_buffer_released(size_t bytes);
+
+#else
+
+class stage_timer
+{
+public:
+  explicit stage_timer(stage)
+  {
+  }
+
+  void stop()
+  {
+  }
+
+  stage_timer(const stage_timer &) = delete;
+  stage_timer &operator=(const stage_timer &) = delete;
+};
+
+inline void count(counter, uint64_t)
+{
+}
+
+inline void note_buffer_acquired(size_t)
+{
+}
+
+inline void note_buffer_released(size_t)
+{
+}
+
+#endif
+
+#endif
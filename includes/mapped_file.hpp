@@ -0,0 +1,77 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Whole file mapped in memory (POSIX mmap).
+class mapped_file
+{
+public:
+  // maps an existing file copy-on-write: the pages can be modified in
+  // memory, the file never is
+  explicit mapped_file(const std::string &filename);
+
+  // maps size bytes for writing to filename. They go to a temporary file
+  // next to it, with its blocks reserved, which replaces filename on
+  // commit() and is removed if the mapping is destroyed before that
+  mapped_file(const std::string &filename, size_t size);
+
+  // unmaps the file written and renames it to filename
+  void commit();
+
+  ~mapped_file();
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  uint8_t *data()
+  {
+    return bytes;
+  }
+
+  const uint8_t *data() const
+  {
+    return bytes;
+  }
+
+  size_t size() const
+  {
+    return length;
+  }
+
+private:
+  uint8_t *bytes = nullptr;
+  size_t length = 0;
+  std::string target;
+  std::string temporary; // until commit(), when writing
+};
+
+// Output written as a stream, whose size is not known up front: the file
+// at path() is created exclusively next to filename, replaces filename on
+// commit() and is removed if destroyed before that.
+class temporary_file
+{
+public:
+  explicit temporary_file(const std::string &filename);
+
+  const std::string &path() const
+  {
+    return temporary;
+  }
+
+  // renames the file written, which must be closed, to filename
+  void commit();
+
+  ~temporary_file();
+
+  temporary_file(const temporary_file &) = delete;
+  temporary_file &operator=(const temporary_file &) = delete;
+
+private:
+  std::string target;
+  std::string temporary; // until commit()
+};
+
+#endif
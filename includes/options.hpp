@@ -5,6 +5,8 @@
 #include <list>
 #include <boost/program_options.hpp> // exceptions also
 
+#include <colour_transform.hpp>
+#include <entropy.hpp>
 #include <predictors.hpp>
 
 
@@ -13,15 +15,24 @@ class options
   public:
 
       bool verbose;
+      std::string trace;
       bool help;
       bool version;
 
       bool compress;
+      bool batch;
 
       std::string input;
       std::string output;
 
       predictor_type predictor;
+      entropy_type entropy;
+      size_t bands;
+      colour_transform transform;
+      size_t tiles;
+      size_t threads;
+      bool stream;
+      size_t passes;
 
       static void show_help();
       static void show_version();
@@ -31,7 +42,15 @@ class options
      help(false),
      version(false),
      compress(false),
-     predictor(predictor_type::none)
+     batch(false),
+     predictor(predictor_type::none),
+     entropy(entropy_type::huffman),
+     bands(1),
+     transform(colour_transform::none),
+     tiles(1),
+     threads(0),
+     stream(false),
+     passes(0)
   {}
 
   options(int, const char * const[]);
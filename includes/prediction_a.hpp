@@ -0,0 +1,36 @@
+#ifndef PREDICTION_A_HPP
+#define PREDICTION_A_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// Gradient adjusted prediction of one channel, branch free. dh and dv are
+// computed from the same neighbours, as they always were, so the thresholds
+// only matter if that ever changes; the vector kernels follow the same rules.
+inline uint8_t prediction_a(int w, int ww, int n, int nw, int ne)
+{
+  int dh = std::abs(w - ww) + std::abs(n - nw) + std::abs(ne - n);
+  int dv = std::abs(w - ww) + std::abs(n - nw) + std::abs(ne - n);
+  int d = dh - dv;
+
+  uint8_t base = ((n + w) / 2) + ((ne - nw) / 4);
+  int p = base;
+  p = d < -8 ? ((3 * base) + w) / 4 : p;
+  p = d > 8 ? ((3 * base) + n) / 4 : p;
+  p = d < -32 ? (base + w) / 2 : p;
+  p = d > 32 ? (base + n) / 2 : p;
+  p = d < -80 ? w : p;
+  p = d > 80 ? n : p;
+  return p;
+}
+
+// Predicts channel bytes [begin, end) of a row of interleaved RGB, where
+// above is the previous row and north_east[i] is the NE neighbour of byte i.
+// Every byte read must already be final, so this is only usable when the
+// whole current row is known (the encoder). Dispatches once to AVX2, SSE4.1
+// or scalar code depending on the CPU.
+void predict_row_a(const uint8_t *above, const uint8_t *current, const uint8_t *north_east, uint8_t *prediction,
+                   size_t begin, size_t end);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef PREDICTION_D_HPP
+#define PREDICTION_D_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// JPEG-LS median edge detector: the median of W, N and W + N - NW, which is
+// W + N - NW clamped between W and N. No branches.
+inline uint8_t prediction_d(int w, int n, int nw)
+{
+  return std::min(std::max(w + n - nw, std::min(w, n)), std::max(w, n));
+}
+
+// Residuals of channel bytes [begin, end) of a row of interleaved RGB, with
+// begin >= 3 and above the previous row. Built for SSE2, SSSE3 and AVX2,
+// chosen once depending on the CPU.
+void residual_row_d(const uint8_t *above, const uint8_t *current, uint8_t *delta, size_t begin, size_t end);
+
+#endif
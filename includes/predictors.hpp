@@ -6,7 +6,10 @@ enum class predictor_type
    none,       // invalide
 	 A,
 	 B,
-	 C
+	 C,
+	 C_rows,     // zigzag de C sur les lignes (streaming)
+	 automatic,  // choisi par échantillonnage, bande par bande
+	 D           // MED de JPEG-LS, rapide
   };
 
 
@@ -0,0 +1,183 @@
+#ifndef RANGE_CODER_HPP
+#define RANGE_CODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Binary adaptive range coder. Probabilities are 11-bit estimates that the
+// next bit is 0 and move toward each coded bit, so no statistics need to be
+// gathered or stored beforehand. Carries are propagated through a cached
+// byte and a run of pending 0xff bytes.
+class range_encoder
+{
+public:
+  static const unsigned probability_bits = 11;
+  static const uint16_t probability_half = 1 << (probability_bits - 1);
+
+  explicit range_encoder(std::vector<uint8_t> &out_) : out(out_)
+  {
+  }
+
+  void encode(uint16_t &probability, unsigned bit)
+  {
+    uint32_t bound = (range >> probability_bits) * probability;
+    if (bit)
+    {
+      low += bound;
+      range -= bound;
+      probability -= probability >> adapt_shift;
+    }
+    else
+    {
+      range = bound;
+      probability += ((1 << probability_bits) - probability) >> adapt_shift;
+    }
+    while (range < top)
+    {
+      range <<= 8;
+      shift_low();
+    }
+  }
+
+  // writes out the last bytes, the encoder is done afterwards
+  void flush()
+  {
+    for (int i = 0; i < 5; i++)
+    {
+      shift_low();
+    }
+  }
+
+private:
+  static const unsigned adapt_shift = 5;
+  static const uint32_t top = 1 << 24;
+
+  void shift_low()
+  {
+    if (uint32_t(low) < 0xff000000u || (low >> 32))
+    {
+      uint8_t carry = uint8_t(low >> 32);
+      uint8_t b = cache;
+      do
+      {
+        out.push_back(uint8_t(b + carry));
+        b = 0xff;
+      } while (--pending);
+      cache = uint8_t(low >> 24);
+    }
+    pending++;
+    low = (low & 0x00ffffff) << 8;
+  }
+
+  std::vector<uint8_t> &out;
+  uint64_t low = 0;
+  uint32_t range = 0xffffffff;
+  uint8_t cache = 0;
+  size_t pending = 1;
+};
+
+// Reads back what range_encoder produced. Reading past the end yields zeros.
+class range_decoder
+{
+public:
+  range_decoder(const uint8_t *data_, size_t size_) : data(data_), size(size_)
+  {
+    for (int i = 0; i < 5; i++)
+    {
+      code = (code << 8) | next();
+    }
+  }
+
+  unsigned decode(uint16_t &probability)
+  {
+    uint32_t bound = (range >> range_encoder::probability_bits) * probability;
+    unsigned bit;
+    if (code < bound)
+    {
+      range = bound;
+      probability += ((1 << range_encoder::probability_bits) - probability) >> adapt_shift;
+      bit = 0;
+    }
+    else
+    {
+      code -= bound;
+      range -= bound;
+      probability -= probability >> adapt_shift;
+      bit = 1;
+    }
+    while (range < top)
+    {
+      range <<= 8;
+      code = (code << 8) | next();
+    }
+    return bit;
+  }
+
+private:
+  static const unsigned adapt_shift = 5;
+  static const uint32_t top = 1 << 24;
+
+  uint8_t next()
+  {
+    return position < size ? data[position++] : 0;
+  }
+
+  const uint8_t *data;
+  size_t size;
+  size_t position = 0;
+  uint32_t range = 0xffffffff;
+  uint32_t code = 0;
+};
+
+// Residuals are bytes modulo 256. Folding maps 0, -1, 1, -2, ... to 0, 1, 2,
+// 3, ... so small magnitudes of either sign share the top of the bit tree.
+inline uint8_t fold(uint8_t r)
+{
+  return uint8_t((r << 1) ^ -(r >> 7));
+}
+
+inline uint8_t unfold(uint8_t z)
+{
+  return uint8_t((z >> 1) ^ -(z & 1));
+}
+
+// Adaptive model of a byte, coded MSB first down a binary tree of 255
+// probabilities: each bit is predicted from the bits above it.
+class byte_model
+{
+public:
+  byte_model()
+  {
+    for (auto &p : probabilities)
+    {
+      p = range_encoder::probability_half;
+    }
+  }
+
+  void encode(range_encoder &rc, uint8_t symbol)
+  {
+    unsigned node = 1;
+    for (int i = 7; i >= 0; i--)
+    {
+      unsigned bit = (symbol >> i) & 1;
+      rc.encode(probabilities[node], bit);
+      node = (node << 1) | bit;
+    }
+  }
+
+  uint8_t decode(range_decoder &rc)
+  {
+    unsigned node = 1;
+    while (node < 256)
+    {
+      node = (node << 1) | rc.decode(probabilities[node]);
+    }
+    return uint8_t(node);
+  }
+
+private:
+  uint16_t probabilities[256];
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed from a FIFO queue.
+class thread_pool
+{
+public:
+  // 0 threads means one per core
+  explicit thread_pool(size_t threads = 0)
+  {
+    if (threads == 0)
+    {
+      threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    // the thread calling parallel_for works too
+    for (size_t i = 1; i < threads; i++)
+    {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+
+  ~thread_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers)
+    {
+      t.join();
+    }
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  size_t size() const
+  {
+    return workers.size() + 1;
+  }
+
+  void submit(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // runs f(i) for every i in [0, count) on the workers and the calling thread
+  // and returns once all are done. The first exception thrown by f is
+  // rethrown here. Helpers that only get scheduled after the work is gone
+  // return immediately, so nested calls from inside a task cannot deadlock.
+  template <typename F> void parallel_for(size_t count, F f)
+  {
+    struct state
+    {
+      std::mutex mutex;
+      std::condition_variable done;
+      size_t next = 0;
+      size_t busy = 0;
+      std::exception_ptr error;
+    };
+    auto s = std::make_shared<state>();
+
+    auto run = [s, count, &f] {
+      std::unique_lock<std::mutex> lock(s->mutex);
+      while (s->next < count)
+      {
+        size_t i = s->next++;
+        s->busy++;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+          f(i);
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+
+        lock.lock();
+        if (error && !s->error)
+        {
+          s->error = error;
+          s->next = count;
+        }
+        s->busy--;
+      }
+      if (s->busy == 0)
+      {
+        s->done.notify_all();
+      }
+    };
+
+    for (size_t h = 0; h < std::min(workers.size(), count ? count - 1 : 0); h++)
+    {
+      submit(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(s->mutex);
+    s->done.wait(lock, [&] { return s->next >= count && s->busy == 0; });
+    if (s->error)
+    {
+      std::rethrow_exception(s->error);
+    }
+  }
+
+private:
+  void work()
+  {
+    for (;;)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty())
+        {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "batch.hpp"
+#include "thread_pool.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+
+#include <glob.h>
+#include <sys/stat.h>
+
+namespace
+{
+bool is_directory(const std::string &path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+size_t file_size(const std::string &path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+std::vector<std::string> glob_files(const std::string &pattern)
+{
+  glob_t matches;
+  int status = glob(pattern.c_str(), 0, nullptr, &matches);
+  if (status != 0 && status != GLOB_NOMATCH)
+  {
+    throw std::runtime_error("can't expand " + pattern);
+  }
+  std::vector<std::string> files;
+  for (size_t i = 0; i < matches.gl_pathc; i++)
+  {
+    if (!is_directory(matches.gl_pathv[i]))
+    {
+      files.push_back(matches.gl_pathv[i]);
+    }
+  }
+  globfree(&matches);
+  return files;
+}
+
+// file name without directory nor extension
+std::string stem(const std::string &path)
+{
+  const size_t slash = path.find_last_of('/');
+  std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+} // namespace
+
+std::vector<std::string> batch_inputs(const std::string &source, const std::string &extension)
+{
+  if (is_directory(source))
+  {
+    return glob_files(source + "/*" + extension);
+  }
+  if (source.find_first_of("*?[") != std::string::npos)
+  {
+    return glob_files(source);
+  }
+
+  std::ifstream manifest(source);
+  if (!manifest)
+  {
+    throw std::runtime_error("can't open " + source + " for reading");
+  }
+  std::vector<std::string> files;
+  std::string line;
+  while (std::getline(manifest, line))
+  {
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.pop_back();
+    }
+    if (!line.empty())
+    {
+      files.push_back(line);
+    }
+  }
+  return files;
+}
+
+batch_report run_batch(const std::string &source, const std::string &output_directory, bool compressing,
+                       const compression_settings &settings)
+{
+  const std::vector<std::string> inputs = batch_inputs(source, compressing ? ".ppm" : ".blp");
+  if (inputs.empty())
+  {
+    throw std::runtime_error("no file to process in " + source);
+  }
+  if (mkdir(output_directory.c_str(), 0777) != 0 && errno != EEXIST)
+  {
+    throw std::runtime_error("can't create " + output_directory + ": " + std::strerror(errno));
+  }
+
+  // two inputs with the same name would overwrite each other's output
+  std::vector<std::string> outputs;
+  std::set<std::string> seen;
+  for (const auto &input : inputs)
+  {
+    outputs.push_back(output_directory + "/" + stem(input) + (compressing ? ".blp" : ".ppm"));
+    if (!seen.insert(outputs.back()).second)
+    {
+      throw std::runtime_error("several inputs would be written to " + outputs.back());
+    }
+  }
+
+  batch_report report;
+  report.files = inputs.size();
+  std::mutex mutex;
+  const auto start = std::chrono::steady_clock::now();
+
+  thread_pool pool(settings.threads);
+  pool.parallel_for(inputs.size(), [&](size_t i) {
+    try
+    {
+      if (compressing)
+      {
+        compress(inputs[i], outputs[i], settings, pool);
+      }
+      else
+      {
+        decompress(inputs[i], outputs[i], settings, pool);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      report.bytes_read += file_size(inputs[i]);
+      report.bytes_written += file_size(outputs[i]);
+    }
+    catch (std::exception &e)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      report.errors.push_back(inputs[i] + ": " + e.what());
+    }
+  });
+
+  report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return report;
+}
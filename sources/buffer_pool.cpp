@@ -0,0 +1,142 @@
+#include "buffer_pool.hpp"
+#include "instrumentation.hpp"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace
+{
+// 64-byte steps for small blocks, then eighths of the leading power of two
+size_t size_class(size_t bytes)
+{
+  if (bytes <= 4096)
+  {
+    return (bytes + buffer_alignment - 1) & ~(buffer_alignment - 1);
+  }
+  const size_t step = size_t(1) << (63 - __builtin_clzll(bytes) - 3);
+  return (bytes + step - 1) & ~(step - 1);
+}
+
+void advise_huge_pages(uint8_t *block, size_t bytes)
+{
+#if defined(MADV_HUGEPAGE) && !defined(CODEC_NO_HUGE_PAGES)
+  const uintptr_t huge_page = uintptr_t(2) << 20;
+  const uintptr_t begin = (uintptr_t(block) + huge_page - 1) & ~(huge_page - 1);
+  const uintptr_t end = (uintptr_t(block) + bytes) & ~(huge_page - 1);
+  if (end > begin)
+  {
+    // only advice, a kernel without them just says no
+    madvise(reinterpret_cast<void *>(begin), end - begin, MADV_HUGEPAGE);
+  }
+#else
+  (void)block;
+  (void)bytes;
+#endif
+}
+
+// the pointer operator new returned sits just before the aligned one
+void *allocate(size_t bytes)
+{
+  uint8_t *raw = static_cast<uint8_t *>(::operator new(bytes + buffer_alignment));
+  uint8_t *block = reinterpret_cast<uint8_t *>((uintptr_t(raw) + buffer_alignment) & ~(buffer_alignment - 1));
+  reinterpret_cast<void **>(block)[-1] = raw;
+  advise_huge_pages(block, bytes);
+  return block;
+}
+
+void deallocate(void *block)
+{
+  ::operator delete(static_cast<void **>(block)[-1]);
+}
+
+class pool
+{
+public:
+  void *acquire(size_t bytes)
+  {
+    const size_t size = size_class(bytes);
+    note_buffer_acquired(size);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto kept = free_blocks.find(size);
+      if (kept != free_blocks.end() && !kept->second.empty())
+      {
+        void *block = kept->second.back();
+        kept->second.pop_back();
+        kept_bytes -= size;
+        return block;
+      }
+    }
+    return allocate(size);
+  }
+
+  void release(void *block, size_t bytes)
+  {
+    const size_t size = size_class(bytes);
+    note_buffer_released(size);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (kept_bytes + size <= max_kept_buffer_bytes)
+      {
+        free_blocks[size].push_back(block);
+        kept_bytes += size;
+        return;
+      }
+    }
+    deallocate(block);
+  }
+
+  void trim()
+  {
+    std::map<size_t, std::vector<void *>> blocks;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      blocks.swap(free_blocks);
+      kept_bytes = 0;
+    }
+    for (auto &size : blocks)
+    {
+      for (void *block : size.second)
+      {
+        deallocate(block);
+      }
+    }
+  }
+
+private:
+  std::mutex mutex;
+  std::map<size_t, std::vector<void *>> free_blocks; // by size class
+  size_t kept_bytes = 0;
+};
+
+// never destroyed: bitmaps of other static objects may still release
+// their storage during exit
+pool &shared_pool()
+{
+  static pool *p = new pool;
+  return *p;
+}
+} // namespace
+
+void *acquire_buffer(size_t bytes)
+{
+  return bytes ? shared_pool().acquire(bytes) : nullptr;
+}
+
+void release_buffer(void *buffer, size_t bytes)
+{
+  if (buffer)
+  {
+    shared_pool().release(buffer, bytes);
+  }
+}
+
+void trim_buffers()
+{
+  shared_pool().trim();
+}
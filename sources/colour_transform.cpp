@@ -0,0 +1,86 @@
+#include "colour_transform.hpp"
+#include "cpu_dispatch.hpp"
+
+namespace
+{
+typedef void (*kernel)(uint8_t *, size_t);
+
+// Y, U = B - G, V = R - G
+inline __attribute__((always_inline)) void forward_rct(uint8_t *__restrict p, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t r = p[3 * i], g = p[3 * i + 1], b = p[3 * i + 2];
+    uint8_t u = b - g;
+    uint8_t v = r - g;
+    p[3 * i] = g + ((int8_t(u) + int8_t(v)) >> 2);
+    p[3 * i + 1] = u;
+    p[3 * i + 2] = v;
+  }
+}
+
+inline __attribute__((always_inline)) void inverse_rct(uint8_t *__restrict p, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t y = p[3 * i], u = p[3 * i + 1], v = p[3 * i + 2];
+    uint8_t g = y - ((int8_t(u) + int8_t(v)) >> 2);
+    p[3 * i] = v + g;
+    p[3 * i + 1] = g;
+    p[3 * i + 2] = u + g;
+  }
+}
+
+// Y, Co, Cg
+inline __attribute__((always_inline)) void forward_ycocg(uint8_t *__restrict p, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t r = p[3 * i], g = p[3 * i + 1], b = p[3 * i + 2];
+    uint8_t co = r - b;
+    uint8_t t = b + (int8_t(co) >> 1);
+    uint8_t cg = g - t;
+    p[3 * i] = t + (int8_t(cg) >> 1);
+    p[3 * i + 1] = co;
+    p[3 * i + 2] = cg;
+  }
+}
+
+inline __attribute__((always_inline)) void inverse_ycocg(uint8_t *__restrict p, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint8_t y = p[3 * i], co = p[3 * i + 1], cg = p[3 * i + 2];
+    uint8_t t = y - (int8_t(cg) >> 1);
+    uint8_t b = t - (int8_t(co) >> 1);
+    p[3 * i] = b + co;
+    p[3 * i + 1] = cg + t;
+    p[3 * i + 2] = b;
+  }
+}
+
+template <kernel body> kernel select()
+{
+  return plain_kernel<void(uint8_t *, size_t), body>::select();
+}
+
+// indexed by colour_transform
+const kernel forward_kernels[] = {nullptr, select<forward_rct>(), select<forward_ycocg>()};
+const kernel inverse_kernels[] = {nullptr, select<inverse_rct>(), select<inverse_ycocg>()};
+} // namespace
+
+void forward_transform(colour_transform transform, uint8_t *pixels, size_t count)
+{
+  if (transform != colour_transform::none)
+  {
+    forward_kernels[size_t(transform)](pixels, count);
+  }
+}
+
+void inverse_transform(colour_transform transform, uint8_t *pixels, size_t count)
+{
+  if (transform != colour_transform::none)
+  {
+    inverse_kernels[size_t(transform)](pixels, count);
+  }
+}
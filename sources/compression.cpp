@@ -1,22 +1,56 @@
 #include "compression.hpp"
+#include "bit_stream.hpp"
 #include "bitmap.hpp"
+#include "colour_transform.hpp"
+#include "context_model.hpp"
+#include "huffman_code.hpp"
 #include "huffman_tree.hpp"
+#include "instrumentation.hpp"
+#include "mapped_file.hpp"
 #include "pixel.hpp"
+#include "prediction_a.hpp"
+#include "prediction_d.hpp"
+#include "range_coder.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define BLOCK_SIZE 8
+#define QUANTIZATION_STEP 1
 
+namespace
+{
 void quantize(RGB &rgb)
 {
-  rgb.r /= 1;
-  rgb.g /= 1;
-  rgb.b /= 1;
+  rgb.r /= QUANTIZATION_STEP;
+  rgb.g /= QUANTIZATION_STEP;
+  rgb.b /= QUANTIZATION_STEP;
 }
 
 void dequantize(RGB &rgb)
 {
-  rgb.r *= 1;
-  rgb.g *= 1;
-  rgb.b *= 1;
+  rgb.r *= QUANTIZATION_STEP;
+  rgb.g *= QUANTIZATION_STEP;
+  rgb.b *= QUANTIZATION_STEP;
+}
+
+const uint8_t *channels(const RGB *p)
+{
+  return reinterpret_cast<const uint8_t *>(p);
+}
+
+uint8_t *channels(RGB *p)
+{
+  return reinterpret_cast<uint8_t *>(p);
 }
 
 void compress_predict_from_previous(const bitmap<RGB> &input, bitmap<RGB> &reconstructed, bitmap<RGB> &deltas, size_t x,
@@ -43,8 +77,122 @@ RGB decompress_predict_from_previous(bitmap<RGB> &output, const bitmap<RGB> &del
   return prediction + delta;
 }
 
+// Lossless C without walking columns. Even columns go down and odd ones up,
+// so every residual is a difference with the pixel above or below, except
+// at the U-turns, and both sides are computed in row-major sweeps over
+// whole rows. 0xff in column_mask marks the bytes of even columns.
+std::vector<uint8_t> c_column_mask(size_t width)
+{
+  std::vector<uint8_t> mask(3 * width);
+  for (size_t i = 0; i < mask.size(); i++)
+  {
+    mask[i] = (i / 3) % 2 ? 0 : 0xff;
+  }
+  return mask;
+}
+
+void compress_c_raster(const bitmap<RGB> &input, bitmap<RGB> &deltas)
+{
+  const size_t width = input.width();
+  const size_t height = input.height();
+  if (!width || !height)
+  {
+    return;
+  }
+  const std::vector<uint8_t> column_mask = c_column_mask(width);
+  const uint8_t *mask = column_mask.data();
+
+  for (size_t y = 0; y < height; y++)
+  {
+    // rows past the edges are never selected, see the U-turns below
+    const uint8_t *row = channels(&input.pixel(0, y));
+    const uint8_t *up = channels(&input.pixel(0, y ? y - 1 : y));
+    const uint8_t *down = channels(&input.pixel(0, y + 1 < height ? y + 1 : y));
+    uint8_t *d = channels(&deltas.pixel(0, y));
+    for (size_t i = 0; i < 3 * width; i++)
+    {
+      d[i] = row[i] - ((up[i] & mask[i]) | (down[i] & ~mask[i]));
+    }
+  }
+
+  // U-turns: even columns start at the top, odd ones at the bottom
+  deltas.pixel(0, 0) = input.pixel(0, 0);
+  for (size_t x = 1; x < width; x++)
+  {
+    const size_t y = x % 2 ? height - 1 : 0;
+    deltas.pixel(x, y) = input.pixel(x, y) - input.pixel(x - 1, y);
+  }
+}
+
+// A first sweep sums each column's residuals, a scan over the columns turns
+// the sums into the value of every column's top pixel, and a second sweep
+// rebuilds rows from the row above: plus this row's residual going down,
+// minus the previous row's going up.
+void decompress_c_raster(const bitmap<RGB> &deltas, bitmap<RGB> &output)
+{
+  const size_t width = output.width();
+  const size_t height = output.height();
+  if (!width || !height)
+  {
+    return;
+  }
+  const std::vector<uint8_t> column_mask = c_column_mask(width);
+  const uint8_t *mask = column_mask.data();
+
+  // down columns sum rows 1 to h - 1, up columns rows 0 to h - 2
+  std::vector<uint8_t> sums(3 * width);
+  for (size_t y = 0; y < height; y++)
+  {
+    const uint8_t *d = channels(&deltas.pixel(0, y));
+    for (size_t i = 0; i < 3 * width; i++)
+    {
+      sums[i] += d[i];
+    }
+  }
+  const uint8_t *first = channels(&deltas.pixel(0, 0));
+  const uint8_t *last = channels(&deltas.pixel(0, height - 1));
+  for (size_t i = 0; i < 3 * width; i++)
+  {
+    sums[i] -= (first[i] & mask[i]) | (last[i] & ~mask[i]);
+  }
+
+  const RGB *sum = reinterpret_cast<const RGB *>(sums.data());
+  RGB *top = &output.pixel(0, 0);
+  top[0] = deltas.pixel(0, 0);
+  for (size_t x = 1; x < width; x++)
+  {
+    if (x % 2)
+    {
+      RGB bottom = top[x - 1] + sum[x - 1] + deltas.pixel(x, height - 1);
+      top[x] = bottom + sum[x];
+    }
+    else
+    {
+      top[x] = top[x - 1] + deltas.pixel(x, 0);
+    }
+  }
+
+  for (size_t y = 1; y < height; y++)
+  {
+    const uint8_t *up = channels(&output.pixel(0, y - 1));
+    const uint8_t *d = channels(&deltas.pixel(0, y));
+    const uint8_t *d_up = channels(&deltas.pixel(0, y - 1));
+    uint8_t *row = channels(&output.pixel(0, y));
+    for (size_t i = 0; i < 3 * width; i++)
+    {
+      row[i] = up[i] + ((d[i] & mask[i]) | (uint8_t(-d_up[i]) & ~mask[i]));
+    }
+  }
+}
+
 void compress_c(const bitmap<RGB> &input, bitmap<RGB> &deltas)
 {
+  if (QUANTIZATION_STEP == 1)
+  {
+    compress_c_raster(input, deltas);
+    return;
+  }
+
   bitmap<RGB> reconstructed(input.width(), input.height());
   for (size_t x = 0; x < input.width(); x++)
   {
@@ -84,6 +232,12 @@ void compress_c(const bitmap<RGB> &input, bitmap<RGB> &deltas)
 
 void decompress_c(const bitmap<RGB> &deltas, bitmap<RGB> &output)
 {
+  if (QUANTIZATION_STEP == 1)
+  {
+    decompress_c_raster(deltas, output);
+    return;
+  }
+
   for (size_t x = 0; x < output.width(); x++)
   {
     // U-turn
@@ -119,6 +273,260 @@ void decompress_c(const bitmap<RGB> &deltas, bitmap<RGB> &output)
   }
 }
 
+// C's zigzag turned along the rows: even rows run left to right, odd rows
+// right to left, and each row starts under the pixel the previous one ended
+// on. Only the row above is needed, which makes it streamable. Like the
+// vector paths of A, it relies on QUANTIZATION_STEP being 1.
+void compress_c_row(const RGB *above, const RGB *original, RGB *delta, size_t y, size_t width)
+{
+  if (!width)
+  {
+    return;
+  }
+
+  if (y % 2 == 0)
+  {
+    delta[0] = y ? original[0] - above[0] : original[0];
+    for (size_t x = 1; x < width; x++)
+    {
+      delta[x] = original[x] - original[x - 1];
+    }
+  }
+  else
+  {
+    delta[width - 1] = original[width - 1] - above[width - 1];
+    for (size_t x = width - 1; x > 0; x--)
+    {
+      delta[x - 1] = original[x - 1] - original[x];
+    }
+  }
+}
+
+void decompress_c_row(const RGB *above, RGB *current, const RGB *delta, size_t y, size_t width)
+{
+  if (!width)
+  {
+    return;
+  }
+
+  if (y % 2 == 0)
+  {
+    current[0] = y ? above[0] + delta[0] : delta[0];
+    for (size_t x = 1; x < width; x++)
+    {
+      current[x] = current[x - 1] + delta[x];
+    }
+  }
+  else
+  {
+    current[width - 1] = above[width - 1] + delta[width - 1];
+    for (size_t x = width - 1; x > 0; x--)
+    {
+      current[x - 1] = current[x] + delta[x - 1];
+    }
+  }
+}
+
+void compress_c_rows(const bitmap<RGB> &input, bitmap<RGB> &deltas)
+{
+  for (size_t y = 0; y < input.height(); y++)
+  {
+    compress_c_row(y ? &input.pixel(0, y - 1) : nullptr, &input.pixel(0, y), &deltas.pixel(0, y), y, input.width());
+  }
+}
+
+void decompress_c_rows(const bitmap<RGB> &deltas, bitmap<RGB> &output)
+{
+  for (size_t y = 0; y < output.height(); y++)
+  {
+    decompress_c_row(y ? &output.pixel(0, y - 1) : nullptr, &output.pixel(0, y), &deltas.pixel(0, y), y,
+                     output.width());
+  }
+}
+
+// Predictor D (MED), in raster order. The first row predicts from W and the first
+// column from N. Like C_rows it relies on QUANTIZATION_STEP being 1.
+void compress_d_row(const RGB *above, const RGB *original, RGB *delta, size_t y, size_t width)
+{
+  const uint8_t *n = channels(above);
+  const uint8_t *x = channels(original);
+  uint8_t *d = channels(delta);
+  if (!width)
+  {
+    return;
+  }
+
+  if (!y)
+  {
+    delta[0] = original[0];
+    for (size_t i = 3; i < 3 * width; i++)
+    {
+      d[i] = x[i] - x[i - 3];
+    }
+    return;
+  }
+
+  delta[0] = original[0] - above[0];
+  residual_row_d(n, x, d, 3, 3 * width);
+}
+
+void decompress_d_row(const RGB *above, RGB *current, const RGB *delta, size_t y, size_t width)
+{
+  const uint8_t *n = channels(above);
+  uint8_t *x = channels(current);
+  const uint8_t *d = channels(delta);
+  if (!width)
+  {
+    return;
+  }
+
+  if (!y)
+  {
+    current[0] = delta[0];
+    for (size_t i = 3; i < 3 * width; i++)
+    {
+      x[i] = x[i - 3] + d[i];
+    }
+    return;
+  }
+
+  current[0] = above[0] + delta[0];
+  for (size_t i = 3; i < 3 * width; i++)
+  {
+    x[i] = prediction_d(x[i - 3], n[i], n[i - 3]) + d[i];
+  }
+}
+
+// rows are independent when encoding
+void compress_d(const bitmap<RGB> &input, bitmap<RGB> &deltas, thread_pool &pool)
+{
+  const size_t rows_per_task = 64;
+  pool.parallel_for((input.height() + rows_per_task - 1) / rows_per_task, [&](size_t t) {
+    for (size_t y = t * rows_per_task; y < std::min(input.height(), (t + 1) * rows_per_task); y++)
+    {
+      compress_d_row(y ? &input.pixel(0, y - 1) : nullptr, &input.pixel(0, y), &deltas.pixel(0, y), y,
+                     input.width());
+    }
+  });
+}
+
+void decompress_d(const bitmap<RGB> &deltas, bitmap<RGB> &output)
+{
+  for (size_t y = 0; y < output.height(); y++)
+  {
+    decompress_d_row(y ? &output.pixel(0, y - 1) : nullptr, &output.pixel(0, y), &deltas.pixel(0, y), y,
+                     output.width());
+  }
+}
+
+// Lossless B in raster order. A pixel whose coordinates are multiples of g
+// but not both of 2g belongs to the pass of blocks 2g: it is predicted from g
+// pixels up when y is no more aligned than x, and from g pixels left
+// otherwise. Both come earlier in raster order, so one sweep gives the same
+// residuals as the passes. Within a row, pixels go by decreasing alignment
+// of x, so each group only reads finished pixels and has no dependency of
+// its own; the odd rows, half the image, are one contiguous difference with
+// the row above.
+size_t b_alignment(size_t v)
+{
+  return v ? std::min<size_t>(BLOCK_SIZE, v & -v) : BLOCK_SIZE;
+}
+
+// d = a - b[-back] for every step-th pixel from first, as channel bytes
+inline void sub_pixels(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t back, size_t first, size_t step,
+                       size_t width)
+{
+  if (step == 1)
+  {
+    for (size_t i = 3 * first; i < 3 * width; i++)
+    {
+      d[i] = a[i] - b[i - back];
+    }
+    return;
+  }
+  for (size_t i = 3 * first; i < 3 * width; i += 3 * step)
+  {
+    d[i] = a[i] - b[i - back];
+    d[i + 1] = a[i + 1] - b[i + 1 - back];
+    d[i + 2] = a[i + 2] - b[i + 2 - back];
+  }
+}
+
+// out = b[-back] + d, same pixels
+inline void add_pixels(uint8_t *out, const uint8_t *b, const uint8_t *d, size_t back, size_t first, size_t step,
+                       size_t width)
+{
+  if (step == 1)
+  {
+    for (size_t i = 3 * first; i < 3 * width; i++)
+    {
+      out[i] = b[i - back] + d[i];
+    }
+    return;
+  }
+  for (size_t i = 3 * first; i < 3 * width; i += 3 * step)
+  {
+    out[i] = b[i - back] + d[i];
+    out[i + 1] = b[i + 1 - back] + d[i + 1];
+    out[i + 2] = b[i + 2 - back] + d[i + 2];
+  }
+}
+
+void compress_b_raster(const bitmap<RGB> &input, bitmap<RGB> &deltas)
+{
+  const size_t width = input.width();
+  for (size_t y = 0; y < input.height(); y++)
+  {
+    const size_t gy = b_alignment(y);
+    const uint8_t *row = channels(&input.pixel(0, y));
+    uint8_t *d = channels(&deltas.pixel(0, y));
+    if (gy == BLOCK_SIZE)
+    {
+      // bootstrap
+      for (size_t x = 0; x < width; x += BLOCK_SIZE)
+      {
+        deltas.pixel(x, y) = input.pixel(x, y);
+      }
+    }
+    else
+    {
+      sub_pixels(d, row, channels(&input.pixel(0, y - gy)), 0, 0, gy, width);
+    }
+
+    for (size_t g = gy / 2; g; g /= 2)
+    {
+      sub_pixels(d, row, row, 3 * g, g, 2 * g, width);
+    }
+  }
+}
+
+void decompress_b_raster(const bitmap<RGB> &deltas, bitmap<RGB> &output)
+{
+  const size_t width = output.width();
+  for (size_t y = 0; y < output.height(); y++)
+  {
+    const size_t gy = b_alignment(y);
+    uint8_t *row = channels(&output.pixel(0, y));
+    const uint8_t *d = channels(&deltas.pixel(0, y));
+    if (gy == BLOCK_SIZE)
+    {
+      for (size_t x = 0; x < width; x += BLOCK_SIZE)
+      {
+        output.pixel(x, y) = deltas.pixel(x, y);
+      }
+    }
+    else
+    {
+      add_pixels(row, channels(&output.pixel(0, y - gy)), d, 0, 0, gy, width);
+    }
+
+    for (size_t g = gy / 2; g; g /= 2)
+    {
+      add_pixels(row, row, d, 3 * g, g, 2 * g, width);
+    }
+  }
+}
+
 void compress_b_pass(const bitmap<RGB> &input, bitmap<RGB> &deltas, bitmap<RGB> &reconstructed, const size_t block_size)
 {
   const size_t half_block_size = block_size / 2;
@@ -141,6 +549,12 @@ void compress_b_pass(const bitmap<RGB> &input, bitmap<RGB> &deltas, bitmap<RGB>
 
 void compress_b(const bitmap<RGB> &input, bitmap<RGB> &deltas, size_t block_size = BLOCK_SIZE)
 {
+  if (QUANTIZATION_STEP == 1 && block_size == BLOCK_SIZE)
+  {
+    compress_b_raster(input, deltas);
+    return;
+  }
+
   bitmap<RGB> reconstructed(input.width(), input.height());
 
   // bootstrap
@@ -181,6 +595,12 @@ void decompress_b_pass(const bitmap<RGB> &deltas, bitmap<RGB> &output, const siz
 
 void decompress_b(const bitmap<RGB> &deltas, bitmap<RGB> &output, size_t block_size = BLOCK_SIZE)
 {
+  if (QUANTIZATION_STEP == 1 && block_size == BLOCK_SIZE)
+  {
+    decompress_b_raster(deltas, output);
+    return;
+  }
+
   // bootstrap
   for (size_t x = 0; x < output.width(); x += block_size)
   {
@@ -196,264 +616,1814 @@ void decompress_b(const bitmap<RGB> &deltas, bitmap<RGB> &output, size_t block_s
   }
 }
 
-RGB prediction_a(const bitmap<RGB> &input, size_t x, size_t y)
+// NE as the former column-major scan saw it: column x + 1 was still blank
+// below the bootstrap rows, and past the right edge the index wrapped to the
+// first pixel of the current row. Kept as is so archives stay bit-identical.
+const RGB &north_east_a(const RGB *above, const RGB *current, size_t x, size_t y, size_t width)
 {
-  RGB16 w = input.pixel(x - 1, y);
-  RGB16 ww = input.pixel(x - 2, y);
-  RGB16 n = input.pixel(x, y - 1);
-  RGB16 nn = input.pixel(x, y - 2);
-  RGB16 nw = input.pixel(x - 1, y - 1);
-  RGB16 ne = input.pixel(x + 1, y - 1);
-  RGB16 nne = input.pixel(x + 1, y - 2);
+  static const RGB blank;
+  if (x + 1 == width)
+  {
+    return current[0];
+  }
+  return y == 2 ? above[x + 1] : blank;
+}
 
-  RGB16 dh = RGB16::abs_sub(w, ww) + RGB16::abs_sub(n, nw) + RGB16::abs_sub(ne, n);
-  RGB16 dv = RGB16::abs_sub(w, ww) + RGB16::abs_sub(n, nw) + RGB16::abs_sub(ne, n);
+RGB prediction_a(const RGB *above, const RGB *current, size_t x, const RGB &north_east)
+{
+  const RGB &w = current[x - 1];
+  const RGB &ww = current[x - 2];
+  const RGB &n = above[x];
+  const RGB &nw = above[x - 1];
 
   RGB pixel;
   for (size_t p = 0; p < 3; p++)
   {
-    if (dh[p] - dv[p] > 80)
-    {
-      pixel[p] = n[p];
-    }
-    else if (dv[p] - dh[p] > 80)
-    {
-      pixel[p] = w[p];
-    }
-    else
-    {
-      pixel[p] = ((n[p] + w[p]) / 2) + ((ne[p] - nw[p]) / 4);
-      if (dh[p] - dv[p] > 32)
-      {
-        pixel[p] = (pixel[p] + n[p]) / 2;
-      }
-      else if (dv[p] - dh[p] > 32)
-      {
-        pixel[p] = (pixel[p] + w[p]) / 2;
-      }
-      else if (dh[p] - dv[p] > 8)
-      {
-        pixel[p] = ((3 * pixel[p]) + n[p]) / 4;
-      }
-      else if (dv[p] - dh[p] > 8)
-      {
-        pixel[p] = ((3 * pixel[p]) + w[p]) / 4;
-      }
-    }
+    // the channel predictor of prediction_a.hpp, hidden by this overload
+    pixel[p] = ::prediction_a(w[p], ww[p], n[p], nw[p], north_east[p]);
   }
-
   return pixel;
 }
 
-void compress_a(const bitmap<RGB> &input, bitmap<RGB> &deltas)
+// Without quantization the reconstructed rows are the input rows, so a whole
+// row can be predicted at once by the vector kernel, and rows do not depend
+// on each other. prediction and blank are scratch rows of width pixels,
+// blank all zeros.
+void compress_a_row(const RGB *above, const RGB *original, RGB *delta, size_t y, size_t width, RGB *prediction,
+                    const RGB *blank)
 {
-  bitmap<RGB> reconstructed(input.width(), input.height());
-
   // bootstrap
-  for (size_t x = 0; x < input.width(); x++)
+  const size_t first = y < 2 ? width : std::min<size_t>(2, width);
+  for (size_t x = 0; x < first; x++)
   {
-    for (size_t y = 0; y < 2; y++)
-    {
-      reconstructed.pixel(x, y) = input.pixel(x, y);
-      deltas.pixel(x, y) = input.pixel(x, y);
-    }
+    delta[x] = original[x];
   }
-
-  // bootstrap
-  for (size_t x = 0; x < 2; x++)
+  if (first >= width)
   {
-    for (size_t y = 0; y < input.height(); y++)
-    {
-      reconstructed.pixel(x, y) = input.pixel(x, y);
-      deltas.pixel(x, y) = input.pixel(x, y);
-    }
+    return;
   }
 
-  for (size_t x = 2; x < input.width(); x++)
+  // the last pixel has its own NE, see north_east_a
+  const RGB *north_east = y == 2 ? above + 1 : blank;
+  predict_row_a(channels(above), channels(original), channels(north_east), channels(prediction), 3 * first,
+                3 * (width - 1));
+  prediction[width - 1] = prediction_a(above, original, width - 1, north_east_a(above, original, width - 1, y, width));
+
+  for (size_t x = first; x < width; x++)
   {
-    for (size_t y = 2; y < input.height(); y++)
-    {
-      RGB original = input.pixel(x, y);
-      RGB prediction = prediction_a(reconstructed, x, y);
-      RGB delta = original - prediction;
+    RGB d = original[x] - prediction[x];
+    quantize(d);
+    delta[x] = d;
+  }
+}
 
-      quantize(delta);
-      deltas.pixel(x, y) = delta;
+void compress_a_rows(const bitmap<RGB> &input, bitmap<RGB> &deltas, size_t y_begin, size_t y_end)
+{
+  const size_t width = input.width();
+  std::vector<RGB> prediction(width);
+  const std::vector<RGB> blank(width);
 
-      dequantize(delta);
-      reconstructed.pixel(x, y) = prediction + delta;
-    }
+  for (size_t y = y_begin; y < y_end; y++)
+  {
+    compress_a_row(y ? &input.pixel(0, y - 1) : nullptr, &input.pixel(0, y), &deltas.pixel(0, y), y, width,
+                   prediction.data(), blank.data());
   }
 }
 
-void decompress_a(const bitmap<RGB> &deltas, bitmap<RGB> &output)
+// Raster scan; only the previous and current reconstructed rows are kept.
+void compress_a(const bitmap<RGB> &input, bitmap<RGB> &deltas, thread_pool &pool)
 {
-  // bootstrap
-  for (size_t x = 0; x < output.width(); x++)
+  if (QUANTIZATION_STEP == 1)
   {
-    for (size_t y = 0; y < 2; y++)
-    {
-      output.pixel(x, y) = deltas.pixel(x, y);
-    }
+    const size_t rows_per_task = 16;
+    pool.parallel_for((input.height() + rows_per_task - 1) / rows_per_task, [&](size_t t) {
+      compress_a_rows(input, deltas, t * rows_per_task, std::min(input.height(), (t + 1) * rows_per_task));
+    });
+    return;
   }
 
-  // bootstrap
-  for (size_t x = 0; x < 2; x++)
+  const size_t width = input.width();
+  const size_t bootstrap_width = std::min<size_t>(2, width);
+  std::vector<RGB> window[2] = {std::vector<RGB>(width), std::vector<RGB>(width)};
+
+  for (size_t y = 0; y < input.height(); y++)
   {
-    for (size_t y = 0; y < output.height(); y++)
+    const RGB *above = window[(y + 1) & 1].data();
+    RGB *current = window[y & 1].data();
+    const RGB *original = &input.pixel(0, y);
+    RGB *delta = &deltas.pixel(0, y);
+
+    // bootstrap
+    const size_t first = y < 2 ? width : bootstrap_width;
+    for (size_t x = 0; x < first; x++)
     {
-      output.pixel(x, y) = deltas.pixel(x, y);
+      current[x] = original[x];
+      delta[x] = original[x];
     }
-  }
 
-  for (size_t x = 2; x < output.width(); x++)
-  {
-    for (size_t y = 2; y < output.height(); y++)
+    for (size_t x = first; x < width; x++)
     {
-      RGB prediction = prediction_a(output, x, y);
-      RGB delta = deltas.pixel(x, y);
+      RGB prediction = prediction_a(above, current, x, north_east_a(above, current, x, y, width));
+      RGB d = original[x] - prediction;
+
+      quantize(d);
+      delta[x] = d;
 
-      dequantize(delta);
-      output.pixel(x, y) = prediction + delta;
+      dequantize(d);
+      current[x] = prediction + d;
     }
   }
 }
 
-void compress(const std::string &filepath, const std::string &archivepath, predictor_type predictor)
+// pixels [begin, end) of row y
+void decompress_a_row(const RGB *above, RGB *current, const RGB *delta, size_t y, size_t width, size_t begin,
+                      size_t end)
 {
-  bitmap<RGB> input(filepath);
-  bitmap<RGB> deltas(input.width(), input.height());
-  switch (predictor)
+  // bootstrap
+  const size_t first = y < 2 ? width : std::min<size_t>(2, width);
+  for (size_t x = begin; x < std::min(end, first); x++)
   {
-    case predictor_type::A: compress_a(input, deltas); break;
-    case predictor_type::B: compress_b(input, deltas); break;
-    case predictor_type::C: compress_c(input, deltas); break;
-    default: throw std::runtime_error("Unsupported predictor."); break;
+    current[x] = delta[x];
   }
 
-  huffman_tree_factory<uint8_t> htf;
-  for (size_t i = 0; i < deltas.size(); i++)
+  for (size_t x = std::max(begin, first); x < end; x++)
   {
-    RGB pixel = deltas.linear_pixel(i);
-    for (size_t j = 0; j < 3; j++)
-    {
-      htf.inc_frequency(pixel[j]);
-    }
+    RGB prediction = prediction_a(above, current, x, north_east_a(above, current, x, y, width));
+    RGB d = delta[x];
+
+    dequantize(d);
+    current[x] = prediction + d;
   }
-  auto ht = htf.create();
+}
 
-  std::ofstream archive;
-  archive.open(archivepath, std::ios::binary);
+void decompress_a_row(const bitmap<RGB> &deltas, bitmap<RGB> &output, size_t y, size_t begin, size_t end)
+{
+  decompress_a_row(y ? &output.pixel(0, y - 1) : nullptr, &output.pixel(0, y), &deltas.pixel(0, y), y,
+                   output.width(), begin, end);
+}
 
-  // header
-  size_t width = deltas.width();
-  size_t height = deltas.height();
-  archive.write(reinterpret_cast<const char *>(&predictor), sizeof(predictor));
-  archive.write(reinterpret_cast<const char *>(&width), sizeof(width));
-  archive.write(reinterpret_cast<const char *>(&height), sizeof(height));
+// Rows are handed out in order and a row only moves on while the row above
+// is past NE of the current chunk, so the output is the one of the sequential
+// scan. The lowest unfinished row never waits, which keeps it deadlock free.
+void decompress_a(const bitmap<RGB> &deltas, bitmap<RGB> &output, thread_pool &pool)
+{
+  const size_t width = output.width();
+  const size_t height = output.height();
 
-  // huffman tree
-  size_t ht_size = ht->get_leaves().size();
-  archive.write(reinterpret_cast<const char *>(&ht_size), sizeof(ht_size));
-  for (const auto &l : ht->get_leaves())
+  if (pool.size() == 1 || height < 4)
   {
-    auto symbol = l.first;
-    auto frequency = l.second->get_frequency();
-    archive.write(reinterpret_cast<const char *>(&symbol), sizeof(symbol));
-    archive.write(reinterpret_cast<const char *>(&frequency), sizeof(frequency));
+    for (size_t y = 0; y < height; y++)
+    {
+      decompress_a_row(deltas, output, y, 0, width);
+    }
+    return;
   }
 
-  // variable encoding
-  unsigned char b = 0;
-  size_t index = 0;
-  for (size_t i = 0; i < deltas.size(); i++)
+  const size_t chunk = 256;
+  std::unique_ptr<std::atomic<size_t>[]> done(new std::atomic<size_t>[height]);
+  for (size_t y = 0; y < height; y++)
   {
-    RGB pixel = deltas.linear_pixel(i);
-    for (size_t j = 0; j < 3; j++)
+    done[y] = 0;
+  }
+
+  pool.parallel_for(height, [&](size_t y) {
+    for (size_t x = 0; x < width; x += chunk)
     {
-      auto n = ht->get_leaf(pixel[j]);
-      unsigned code = n.get_code();
-      for (size_t k = 0; k < n.get_code_length(); k++)
+      const size_t end = std::min(width, x + chunk);
+      if (y)
       {
-        b <<= 1;
-        b |= code & 1;
-        code >>= 1;
-        index++;
-
-        if (index == CHAR_BIT)
+        const size_t needed = std::min(width, end + 1);
+        while (done[y - 1].load(std::memory_order_acquire) < needed)
         {
-          archive.write(reinterpret_cast<const char *>(&b), sizeof(b));
-          index = 0;
+          std::this_thread::yield();
         }
       }
+      decompress_a_row(deltas, output, y, x, end);
+      done[y].store(end, std::memory_order_release);
     }
-  }
+  });
+}
+
+void predict(const bitmap<RGB> &input, bitmap<RGB> &deltas, predictor_type predictor, thread_pool &pool)
+{
+  switch (predictor)
+  {
+    case predictor_type::A: compress_a(input, deltas, pool); break;
+    case predictor_type::B: compress_b(input, deltas); break;
+    case predictor_type::C: compress_c(input, deltas); break;
+    case predictor_type::C_rows: compress_c_rows(input, deltas); break;
+    case predictor_type::D: compress_d(input, deltas, pool); break;
+    default: throw std::runtime_error("Unsupported predictor."); break;
+  }
+}
+
+// order 0 entropy of the residuals in bits, with the per channel tables the
+// Huffman coder uses
+double residual_entropy(const bitmap<RGB> &deltas)
+{
+  size_t histogram[3][256] = {};
+  const uint8_t *residuals = channels(deltas.data());
+  for (size_t i = 0; i < deltas.size() * 3; i += 3)
+  {
+    histogram[0][residuals[i]]++;
+    histogram[1][residuals[i + 1]]++;
+    histogram[2][residuals[i + 2]]++;
+  }
+
+  double bits = 0;
+  for (auto &h : histogram)
+  {
+    for (size_t count : h)
+    {
+      if (count)
+      {
+        bits -= count * std::log2(double(count) / deltas.size());
+      }
+    }
+  }
+  return bits;
+}
+
+// Runs every predictor on bands of sample_rows rows taken every
+// sample_period rows of the tile and keeps the one whose residuals have the
+// lowest entropy. That is about an eighth of the work of the slowest one.
+predictor_type choose_predictor(const bitmap<RGB> &tile, thread_pool &pool)
+{
+  const size_t sample_rows = 8;
+  const size_t sample_period = 64;
+  const predictor_type candidates[] = {predictor_type::A, predictor_type::B, predictor_type::C, predictor_type::D};
+
+  predictor_type best = predictor_type::A;
+  double best_bits = 0;
+  for (auto candidate : candidates)
+  {
+    double bits = 0;
+    for (size_t y = 0; y < tile.height(); y += sample_period)
+    {
+      const size_t rows = std::min(sample_rows, tile.height() - y);
+      const bitmap<RGB> sample(tile.width(), rows, const_cast<RGB *>(&tile.pixel(0, y)));
+      bitmap<RGB> deltas = bitmap<RGB>::uninitialised(tile.width(), rows);
+      predict(sample, deltas, candidate, pool);
+      bits += residual_entropy(deltas);
+    }
+    if (candidate == candidates[0] || bits < best_bits)
+    {
+      best = candidate;
+      best_bits = bits;
+    }
+  }
+  return best;
+}
+
+void reconstruct(const bitmap<RGB> &deltas, bitmap<RGB> &output, predictor_type predictor, thread_pool &pool)
+{
+  switch (predictor)
+  {
+    case predictor_type::A: decompress_a(deltas, output, pool); break;
+    case predictor_type::B: decompress_b(deltas, output); break;
+    case predictor_type::C: decompress_c(deltas, output); break;
+    case predictor_type::C_rows: decompress_c_rows(deltas, output); break;
+    case predictor_type::D: decompress_d(deltas, output); break;
+    default: throw std::runtime_error("Unsupported predictor."); break;
+  }
+}
+
+template <typename T> void put_raw(std::vector<uint8_t> &out, const T &value)
+{
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), p, p + sizeof(value));
+}
+
+// reads a T at p and moves past it
+template <typename T> T get_raw(const uint8_t *&p, const uint8_t *end)
+{
+  if (size_t(end - p) < sizeof(T))
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  T value;
+  std::memcpy(&value, p, sizeof(value));
+  p += sizeof(value);
+  return value;
+}
+
+// Code tables are stored as code lengths: the number of symbols used, then
+// (symbol, length) pairs, or all 256 lengths when that is shorter.
+huffman_code write_code(std::vector<uint8_t> &archive, huffman_tree_factory<uint8_t> &htf)
+{
+  stage_timer timer(stage::tree);
+  if (htf.empty())
+  {
+    put_raw(archive, uint16_t(0));
+    return huffman_code();
+  }
+
+  huffman_code code(htf.create(huffman_code::max_code_length));
+
+  put_raw(archive, uint16_t(code.size()));
+  if (code.size() <= huffman_code::symbol_count / 2)
+  {
+    for (size_t i = 0; i < code.size(); i++)
+    {
+      put_raw(archive, code.symbol(i));
+      put_raw(archive, code[code.symbol(i)].length);
+    }
+  }
+  else
+  {
+    for (size_t s = 0; s < huffman_code::symbol_count; s++)
+    {
+      put_raw(archive, code[s].length);
+    }
+  }
+  return code;
+}
+
+huffman_code read_code(const uint8_t *&archive, const uint8_t *end)
+{
+  const size_t count = get_raw<uint16_t>(archive, end);
+  uint8_t symbols[huffman_code::symbol_count];
+  uint8_t lengths[huffman_code::symbol_count];
+  size_t used = 0;
+  if (count <= huffman_code::symbol_count / 2)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      symbols[used] = get_raw<uint8_t>(archive, end);
+      lengths[used++] = get_raw<uint8_t>(archive, end);
+    }
+  }
+  else if (count <= huffman_code::symbol_count)
+  {
+    for (size_t s = 0; s < huffman_code::symbol_count; s++)
+    {
+      uint8_t length = get_raw<uint8_t>(archive, end);
+      if (length)
+      {
+        symbols[used] = s;
+        lengths[used++] = length;
+      }
+    }
+  }
+
+  // the lengths must describe a prefix code, or decoding tables overflow
+  uint64_t kraft = 0;
+  uint32_t seen[huffman_code::symbol_count / 32] = {};
+  for (size_t i = 0; i < used; i++)
+  {
+    if (lengths[i] > huffman_code::max_code_length || (!lengths[i] && used > 1) ||
+        (seen[symbols[i] / 32] & (1u << (symbols[i] % 32))))
+    {
+      throw std::runtime_error("Corrupted archive.");
+    }
+    seen[symbols[i] / 32] |= 1u << (symbols[i] % 32);
+    kraft += uint64_t(1) << (huffman_code::max_code_length - lengths[i]);
+  }
+  if (used != count || kraft > (uint64_t(1) << huffman_code::max_code_length))
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  return huffman_code(symbols, lengths, used);
+}
+
+// Huffman tables are per channel and, with several bands, per band of recent
+// residual magnitude in that channel. The magnitude is a running average of
+// the folded residuals, so it needs no neighbour lookups, carries across
+// calls, and the table index is a plain table lookup.
+class residual_bands
+{
+public:
+  static const size_t max_bands = 9;
+
+  explicit residual_bands(size_t bands_) : bands(bands_)
+  {
+    for (unsigned m = 0; m < 256; m++)
+    {
+      band_of[m] = std::min<unsigned>(bands - 1, 31 - __builtin_clz(m + 1));
+    }
+  }
+
+  size_t size() const
+  {
+    return bands;
+  }
+
+  // table of the next residual of channel c
+  size_t table(size_t c) const
+  {
+    return c * bands + band_of[magnitude[c]];
+  }
+
+  void update(size_t c, uint8_t residual)
+  {
+    magnitude[c] = (magnitude[c] + fold(residual) + 1) / 2;
+  }
+
+  // every channel at magnitude m, 0 to max_magnitude
+  void reset(unsigned m)
+  {
+    std::fill(magnitude, magnitude + 3, m);
+  }
+
+  bool same_state(const residual_bands &other) const
+  {
+    return std::equal(magnitude, magnitude + 3, other.magnitude);
+  }
+
+  static const unsigned max_magnitude = 255;
+
+private:
+  size_t bands;
+  uint8_t band_of[256];
+  unsigned magnitude[3] = {};
+};
+
+// Buffers of the entropy coders, kept from one tile to the next and, in a
+// batch, from one file to the next instead of being allocated for each
+// stream. Every thread has its own, see thread_scratch(), which only the
+// tile it is coding uses: the tasks a tile spreads over the pool do not.
+struct coding_scratch
+{
+  std::vector<uint64_t> counts;     // residual_histogram
+  std::vector<uint32_t> sub_counts; // count_residual_block
+  huffman_tree_factory<uint8_t> factory;
+  std::vector<huffman_code> codes;
+  std::vector<uint8_t> bits; // bit_writer staging
+  std::vector<huffman_decoder> decoders;
+  huffman_pixel_decoder pixels;
+};
+
+coding_scratch &thread_scratch()
+{
+  static thread_local coding_scratch scratch;
+  return scratch;
+}
+
+// Counts the given pixels of residuals into counts (table * 256 + residual)
+// from the band state, and returns the state after them. Pixels go to four
+// interleaved sub-histograms in turn, so that runs of equal residuals do not
+// wait on the increment of the same counter. Those are 32-bit, to stay small
+// in cache, so at most max_residual_block pixels are counted at once, and
+// live in sub.
+const size_t max_residual_block = size_t(1) << 30;
+
+residual_bands count_residual_block(const uint8_t *residuals, size_t pixels, residual_bands state, uint64_t *counts,
+                                    std::vector<uint32_t> &sub)
+{
+  const size_t ways = 4;
+  const size_t tables = 3 * state.size();
+  sub.assign(ways * tables * 256, 0);
+  if (state.size() == 1)
+  {
+    // the table is the channel
+    size_t i = 0;
+    for (; i + ways <= pixels; i += ways)
+    {
+      const uint8_t *p = residuals + 3 * i;
+      for (size_t k = 0; k < ways; k++)
+      {
+        sub[(3 * k + 0) * 256 + p[3 * k + 0]]++;
+        sub[(3 * k + 1) * 256 + p[3 * k + 1]]++;
+        sub[(3 * k + 2) * 256 + p[3 * k + 2]]++;
+      }
+    }
+    for (; i < pixels; i++)
+    {
+      for (size_t c = 0; c < 3; c++)
+      {
+        sub[c * 256 + residuals[3 * i + c]]++;
+      }
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < pixels; i++)
+    {
+      uint32_t *way = &sub[(i % ways) * tables * 256];
+      for (size_t c = 0; c < 3; c++)
+      {
+        way[state.table(c) * 256 + residuals[3 * i + c]]++;
+        state.update(c, residuals[3 * i + c]);
+      }
+    }
+  }
+
+  for (size_t k = 0; k < ways; k++)
+  {
+    for (size_t j = 0; j < tables * 256; j++)
+    {
+      counts[j] += sub[k * tables * 256 + j];
+    }
+  }
+  return state;
+}
+
+residual_bands count_residuals(const uint8_t *residuals, size_t pixels, residual_bands state, uint64_t *counts,
+                               std::vector<uint32_t> &sub)
+{
+  for (size_t done = 0; done < pixels; done += max_residual_block)
+  {
+    state = count_residual_block(residuals + 3 * done, std::min(max_residual_block, pixels - done), state, counts,
+                                 sub);
+  }
+  return state;
+}
+
+// Where the band state stops depending on what came before begin: from the
+// lowest and the highest magnitudes, the running average soon reaches the
+// same state, and as its update is monotonic every other start does too.
+// Returns that pixel, end if it never happens, with the state there.
+size_t band_state_known(const uint8_t *residuals, size_t begin, size_t end, residual_bands &state)
+{
+  if (state.size() == 1)
+  {
+    return begin;
+  }
+  residual_bands high(state);
+  state.reset(0);
+  high.reset(residual_bands::max_magnitude);
+  size_t i = begin;
+  for (; i < end && !state.same_state(high); i++)
+  {
+    for (size_t c = 0; c < 3; c++)
+    {
+      state.update(c, residuals[3 * i + c]);
+      high.update(c, residuals[3 * i + c]);
+    }
+  }
+  return i;
+}
+
+// Huffman frequencies of every table, the factory is only seeded from the
+// final counts. They are counted in the buffers of scratch.
+struct residual_histogram
+{
+  residual_histogram(size_t bands_, coding_scratch &scratch)
+      : bands(bands_), counts(scratch.counts), sub(scratch.sub_counts)
+  {
+    counts.assign(3 * bands_ * 256, 0);
+  }
+
+  // n is a whole number of pixels. With a pool, large inputs are counted in
+  // chunks on several threads; the counts are the same.
+  void add(const uint8_t *residuals, size_t n, thread_pool *pool = nullptr)
+  {
+    stage_timer timer(stage::histogram);
+    const size_t pixels = n / 3;
+    const size_t min_chunk = size_t(1) << 18;
+    const size_t chunks = pool ? std::max<size_t>(1, std::min(pool->size(), pixels / min_chunk)) : 1;
+    if (chunks == 1)
+    {
+      bands = count_residuals(residuals, pixels, bands, counts.data(), sub);
+      return;
+    }
+
+    // each chunk counts from where its band state is known, then the pixels
+    // before that are counted in order, from the end of the previous chunk.
+    // Chunks run on other threads, with buffers of their own.
+    const size_t chunk = (pixels + chunks - 1) / chunks;
+    std::vector<std::vector<uint64_t>> partial(chunks);
+    std::vector<size_t> known(chunks, 0);
+    std::vector<residual_bands> ends(chunks, bands);
+    pool->parallel_for(chunks, [&](size_t k) {
+      const size_t begin = std::min(pixels, k * chunk);
+      const size_t end = std::min(pixels, begin + chunk);
+      std::vector<uint32_t> chunk_sub;
+      partial[k].assign(counts.size(), 0);
+      known[k] = k ? band_state_known(residuals, begin, end, ends[k]) : begin;
+      ends[k] = count_residuals(residuals + 3 * known[k], end - known[k], ends[k], partial[k].data(), chunk_sub);
+    });
+    for (size_t k = 0; k < chunks; k++)
+    {
+      const size_t begin = std::min(pixels, k * chunk);
+      const size_t end = std::min(pixels, begin + chunk);
+      if (k)
+      {
+        bands = count_residuals(residuals + 3 * begin, known[k] - begin, bands, counts.data(), sub);
+      }
+      if (known[k] < end)
+      {
+        bands = ends[k];
+      }
+      for (size_t j = 0; j < counts.size(); j++)
+      {
+        counts[j] += partial[k][j];
+      }
+    }
+  }
+
+  size_t tables() const
+  {
+    return counts.size() / 256;
+  }
+
+  // the frequencies of table t
+  void seed(size_t t, huffman_tree_factory<uint8_t> &htf) const
+  {
+    for (size_t r = 0; r < 256; r++)
+    {
+      htf.set_frequency(uint8_t(r), counts[t * 256 + r]);
+    }
+  }
+
+  residual_bands bands;
+  std::vector<uint64_t> &counts; // table * 256 + residual
+  std::vector<uint32_t> &sub;
+};
+
+// Entropy codes the residuals of one tile, in as many calls as needed, each
+// a whole number of pixels. Huffman writes its tables first and needs the
+// frequencies of everything that will be written; the range coder adapts as
+// it goes. The context coder predicts by itself and is fed rows of pixels.
+class residual_writer
+{
+public:
+  residual_writer(std::vector<uint8_t> &archive, entropy_type entropy_, residual_histogram &histogram,
+                  coding_scratch &scratch)
+      : entropy(entropy_), bands(histogram.bands.size()), codes(scratch.codes), out(archive),
+        bits(archive, scratch.bits), rc(archive)
+  {
+    if (entropy == entropy_type::huffman)
+    {
+      put_raw(archive, bands.size());
+      codes.resize(histogram.tables());
+      for (size_t t = 0; t < codes.size(); t++)
+      {
+        histogram.seed(t, scratch.factory);
+        codes[t] = write_code(archive, scratch.factory);
+      }
+    }
+    if (entropy == entropy_type::context)
+    {
+      context.reset(new context_model);
+    }
+  }
+
+  // context coder only, above2 and above are the two previous rows
+  void write_row(const RGB *above2, const RGB *above, const RGB *current, size_t y, size_t width)
+  {
+    stage_timer timer(stage::packing);
+    const size_t before = out.size();
+    context->encode_row(rc, channels(above2), channels(above), channels(current), y, width);
+    count(counter::bits, 8 * (out.size() - before));
+    count(counter::symbols, 3 * width);
+  }
+
+  // bits are counted as the coders hand whole bytes over to the archive
+  void write(const uint8_t *residuals, size_t n)
+  {
+    stage_timer timer(stage::packing);
+    const size_t before = out.size();
+    if (entropy == entropy_type::huffman)
+    {
+      for (size_t i = 0; i < n; i += 3)
+      {
+        for (size_t c = 0; c < 3; c++)
+        {
+          const auto &e = codes[bands.table(c)][residuals[i + c]];
+          bits.put(e.code, e.length);
+          bands.update(c, residuals[i + c]);
+        }
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        model.encode(rc, fold(residuals[i]));
+      }
+    }
+    count(counter::bits, 8 * (out.size() - before));
+    count(counter::symbols, n);
+  }
+
+  void flush()
+  {
+    stage_timer timer(stage::packing);
+    const size_t before = out.size();
+    if (entropy == entropy_type::huffman)
+    {
+      bits.flush();
+    }
+    else
+    {
+      rc.flush();
+    }
+    count(counter::bits, 8 * (out.size() - before));
+  }
+
+private:
+  entropy_type entropy;
+  residual_bands bands;
+  std::vector<huffman_code> &codes;
+  std::vector<uint8_t> &out;
+  bit_writer bits;
+  range_encoder rc;
+  byte_model model;
+  std::unique_ptr<context_model> context;
+};
+
+class residual_reader
+{
+public:
+  residual_reader(const uint8_t *tile, size_t size, entropy_type entropy_, coding_scratch &scratch)
+      : entropy(entropy_), bands(1), decoders(scratch.decoders), bits(nullptr, 0), rc(tile, size)
+  {
+    stage_timer timer(stage::decode);
+    if (entropy == entropy_type::huffman)
+    {
+      const uint8_t *end = tile + size;
+      const size_t band_count = get_raw<size_t>(tile, end);
+      if (!band_count || band_count > residual_bands::max_bands)
+      {
+        throw std::runtime_error("Corrupted archive.");
+      }
+      bands = residual_bands(band_count);
+      decoders.resize(3 * band_count);
+      for (auto &decoder : decoders)
+      {
+        decoder.assign(read_code(tile, end));
+      }
+      if (band_count == 1)
+      {
+        scratch.pixels.assign(decoders.data());
+        pixels = &scratch.pixels;
+      }
+      bits = bit_reader(tile, end - tile);
+      size = end - tile; // the tables are not coded bits
+    }
+    count(counter::bits, 8 * size);
+    if (entropy == entropy_type::context)
+    {
+      context.reset(new context_model);
+    }
+  }
+
+  void read_row(const RGB *above2, const RGB *above, RGB *current, size_t y, size_t width)
+  {
+    stage_timer timer(stage::decode);
+    context->decode_row(rc, channels(above2), channels(above), channels(current), y, width);
+    count(counter::symbols, 3 * width);
+  }
+
+  void read(uint8_t *residuals, size_t n)
+  {
+    stage_timer timer(stage::decode);
+    if (pixels)
+    {
+      // one table per channel, the band state is not needed
+      for (size_t i = 0; i < n; i += 3)
+      {
+        pixels->decode(bits, residuals + i);
+      }
+    }
+    else if (entropy == entropy_type::huffman)
+    {
+      for (size_t i = 0; i < n; i += 3)
+      {
+        for (size_t c = 0; c < 3; c++)
+        {
+          residuals[i + c] = decoders[bands.table(c)].decode(bits);
+          bands.update(c, residuals[i + c]);
+        }
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        residuals[i] = unfold(model.decode(rc));
+      }
+    }
+    count(counter::symbols, n);
+  }
+
+private:
+  entropy_type entropy;
+  residual_bands bands;
+  std::vector<huffman_decoder> &decoders;
+  const huffman_pixel_decoder *pixels = nullptr; // decoders, single band only
+  bit_reader bits;
+  range_decoder rc;
+  byte_model model;
+  std::unique_ptr<context_model> context;
+};
+
+void write_residuals(std::vector<uint8_t> &archive, const bitmap<RGB> &deltas, entropy_type entropy, size_t bands,
+                     thread_pool &pool, coding_scratch &scratch)
+{
+  const uint8_t *residuals = channels(deltas.data());
+  const size_t n = deltas.size() * 3;
+
+  residual_histogram histogram(bands, scratch);
+  if (entropy == entropy_type::huffman)
+  {
+    histogram.add(residuals, n, &pool);
+  }
+
+  // Both coders average at most about 8 bits per residual here, so this saves
+  // the reallocation copies; untouched pages are never faulted in.
+  archive.reserve(archive.size() + n + n / 12 + 64);
+  residual_writer writer(archive, entropy, histogram, scratch);
+  writer.write(residuals, n);
+  writer.flush();
+}
+
+void read_residuals(const uint8_t *archive, size_t size, bitmap<RGB> &deltas, entropy_type entropy,
+                    coding_scratch &scratch)
+{
+  residual_reader reader(archive, size, entropy, scratch);
+  reader.read(channels(deltas.data()), deltas.size() * 3);
+}
+
+// predictor A through the context coder, prediction and coding in one pass
+void write_context(std::vector<uint8_t> &archive, const bitmap<RGB> &tile, coding_scratch &scratch)
+{
+  archive.reserve(archive.size() + tile.size() * 3 + tile.size() / 4 + 64);
+  residual_histogram histogram(1, scratch);
+  residual_writer writer(archive, entropy_type::context, histogram, scratch);
+  for (size_t y = 0; y < tile.height(); y++)
+  {
+    const RGB *current = &tile.pixel(0, y);
+    const RGB *above = y ? &tile.pixel(0, y - 1) : current;
+    const RGB *above2 = y > 1 ? &tile.pixel(0, y - 2) : above;
+    writer.write_row(above2, above, current, y, tile.width());
+  }
+  writer.flush();
+}
+
+void read_context(const uint8_t *archive, size_t size, bitmap<RGB> &tile, coding_scratch &scratch)
+{
+  residual_reader reader(archive, size, entropy_type::context, scratch);
+  for (size_t y = 0; y < tile.height(); y++)
+  {
+    RGB *current = &tile.pixel(0, y);
+    const RGB *above = y ? &tile.pixel(0, y - 1) : current;
+    const RGB *above2 = y > 1 ? &tile.pixel(0, y - 2) : above;
+    reader.read_row(above2, above, current, y, tile.width());
+  }
+}
+
+// Predictor B tiles are progressive: one segment for the bootstrap grid,
+// then one per pass, each entropy coded on its own after a list of segment
+// ends. Decoding the first n segments gives every pixel on a grid of step
+// BLOCK_SIZE >> (n - 1). Within a segment, positions are in raster order of
+// each of the pass's two halves.
+const size_t b_segments = 1 + __builtin_ctz(BLOCK_SIZE);
+
+// grid step of the pixels known after decoding this many segments
+size_t b_step(size_t segments)
+{
+  return segments ? BLOCK_SIZE >> (segments - 1) : 0;
+}
+
+// number of positions of segment within a width x height tile, those
+// for_each_b_position goes through
+size_t b_segment_size(size_t segment, size_t width, size_t height)
+{
+  // multiples of step from first, below end
+  auto grid = [](size_t first, size_t step, size_t end) { return first < end ? (end - first + step - 1) / step : 0; };
+  if (!segment)
+  {
+    return grid(0, BLOCK_SIZE, height) * grid(0, BLOCK_SIZE, width);
+  }
+  const size_t block_size = b_step(segment);
+  const size_t half_block_size = block_size / 2;
+  return grid(0, block_size, height) * grid(half_block_size, block_size, width) +
+         grid(half_block_size, block_size, height) * grid(0, half_block_size, width);
+}
+
+template <typename F> void for_each_b_position(size_t segment, size_t width, size_t height, F f)
+{
+  if (!segment)
+  {
+    for (size_t y = 0; y < height; y += BLOCK_SIZE)
+    {
+      for (size_t x = 0; x < width; x += BLOCK_SIZE)
+      {
+        f(x, y);
+      }
+    }
+    return;
+  }
+
+  const size_t block_size = b_step(segment);
+  const size_t half_block_size = block_size / 2;
+  for (size_t y = 0; y < height; y += block_size)
+  {
+    for (size_t x = half_block_size; x < width; x += block_size)
+    {
+      f(x, y);
+    }
+  }
+  for (size_t y = half_block_size; y < height; y += block_size)
+  {
+    for (size_t x = 0; x < width; x += half_block_size)
+    {
+      f(x, y);
+    }
+  }
+}
+
+void write_b_segments(std::vector<uint8_t> &archive, const bitmap<RGB> &deltas, entropy_type entropy, size_t bands,
+                      thread_pool &pool, coding_scratch &scratch)
+{
+  std::vector<std::vector<uint8_t>> segments(b_segments);
+  for (size_t s = 0; s < b_segments; s++)
+  {
+    std::vector<RGB> gathered;
+    gathered.reserve(b_segment_size(s, deltas.width(), deltas.height()));
+    for_each_b_position(s, deltas.width(), deltas.height(),
+                        [&](size_t x, size_t y) { gathered.push_back(deltas.pixel(x, y)); });
+    write_residuals(segments[s], bitmap<RGB>(gathered.size(), 1, gathered.data()), entropy, bands, pool, scratch);
+  }
+
+  size_t end = 0;
+  for (const auto &segment : segments)
+  {
+    end += segment.size();
+    put_raw(archive, end);
+  }
+  for (const auto &segment : segments)
+  {
+    archive.insert(archive.end(), segment.begin(), segment.end());
+  }
+}
+
+// Decodes the first count segments of a width x height tile. Their pixels
+// all lie on the grid of step b_step(count), pixel (x, y) goes to
+// deltas(x / step, y / step): deltas is the whole tile with step 1, only
+// that grid for a preview. Other deltas are left alone.
+void read_b_segments(const uint8_t *archive, size_t size, bitmap<RGB> &deltas, entropy_type entropy, size_t count,
+                     size_t width, size_t height, coding_scratch &scratch, size_t step = 1)
+{
+  const uint8_t *end = archive + size;
+  size_t ends[b_segments];
+  for (auto &e : ends)
+  {
+    e = get_raw<size_t>(archive, end);
+  }
+
+  size_t begin = 0;
+  for (size_t s = 0; s < count; s++)
+  {
+    if (ends[s] < begin || ends[s] > size_t(end - archive))
+    {
+      throw std::runtime_error("Corrupted archive.");
+    }
+
+    size_t n = b_segment_size(s, width, height);
+    std::vector<RGB> gathered(n);
+    bitmap<RGB> view(n, 1, gathered.data());
+    read_residuals(archive + begin, ends[s] - begin, view, entropy, scratch);
+
+    n = 0;
+    for_each_b_position(s, width, height,
+                        [&](size_t x, size_t y) { deltas.pixel(x / step, y / step) = gathered[n++]; });
+    begin = ends[s];
+  }
+}
+
+// Most pixels a residual stream of size bytes holds, so that image sizes no
+// archive could decode are rejected before anything is allocated. The range
+// coder spends eight binary decisions on a residual, each over 0.022 bit as
+// probabilities saturate at 2017/2048: more than half a bit per pixel, at
+// most about 15 pixels per byte. A Huffman pixel costs at least the shortest
+// code of each channel, 0 bits when all the tables of every channel have a
+// single residual: such flat tiles are not bounded.
+size_t max_stream_pixels(const uint8_t *stream, size_t size, entropy_type entropy)
+{
+  const size_t unbounded = std::numeric_limits<size_t>::max();
+  if (entropy != entropy_type::huffman)
+  {
+    return size < unbounded / 16 ? 16 * size : unbounded;
+  }
+
+  const uint8_t *end = stream + size;
+  const size_t band_count = get_raw<size_t>(stream, end);
+  if (!band_count || band_count > residual_bands::max_bands)
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  size_t bits = 0;
+  for (size_t c = 0; c < 3; c++)
+  {
+    unsigned shortest = huffman_code::max_code_length;
+    for (size_t b = 0; b < band_count; b++)
+    {
+      const huffman_code code = read_code(stream, end);
+      for (size_t i = 0; i < code.size(); i++)
+      {
+        shortest = std::min<unsigned>(shortest, code[code.symbol(i)].length);
+      }
+    }
+    bits += shortest;
+  }
+  return bits && size < unbounded / 8 ? 8 * size / bits : unbounded;
+}
+
+// Archive header: predictor, entropy coder, colour transform, image size,
+// tile height, then the tile index (offsets from the first tile, plus the
+// end of the last one) and, for the automatic predictor, the predictor of
+// each tile.
+struct archive_layout
+{
+  predictor_type predictor;
+  entropy_type entropy;
+  colour_transform transform;
+  size_t width;
+  size_t height;
+  size_t tile_height;
+  std::vector<size_t> offsets;
+  std::vector<predictor_type> predictors; // per tile, when predictor is automatic
+  const uint8_t *tiles;                   // first tile, when read from an archive
+
+  predictor_type tile_predictor(size_t t) const
+  {
+    return predictor == predictor_type::automatic ? predictors[t] : predictor;
+  }
+
+  size_t tile_count() const
+  {
+    return height ? (height + tile_height - 1) / tile_height : 0;
+  }
+};
+
+std::vector<uint8_t> write_layout(const archive_layout &layout)
+{
+  std::vector<uint8_t> header;
+  put_raw(header, layout.predictor);
+  put_raw(header, layout.entropy);
+  put_raw(header, layout.transform);
+  put_raw(header, layout.width);
+  put_raw(header, layout.height);
+  put_raw(header, layout.tile_height);
+  for (auto o : layout.offsets)
+  {
+    put_raw(header, o);
+  }
+  for (auto predictor : layout.predictors)
+  {
+    put_raw(header, predictor);
+  }
+  return header;
+}
+
+archive_layout read_layout(const uint8_t *archive, size_t size)
+{
+  const uint8_t *p = archive;
+  const uint8_t *end = p + size;
+
+  archive_layout layout;
+  layout.predictor = get_raw<predictor_type>(p, end);
+  layout.entropy = get_raw<entropy_type>(p, end);
+  if (layout.entropy != entropy_type::huffman && layout.entropy != entropy_type::range &&
+      (layout.entropy != entropy_type::context || layout.predictor != predictor_type::A))
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  layout.transform = get_raw<colour_transform>(p, end);
+  if (layout.transform != colour_transform::none && layout.transform != colour_transform::rct &&
+      layout.transform != colour_transform::ycocg)
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  layout.width = get_raw<size_t>(p, end);
+  layout.height = get_raw<size_t>(p, end);
+  layout.tile_height = get_raw<size_t>(p, end);
+  // a tile height past the image would wrap the tile count to 0 and leave
+  // the output undecoded, and the image must fit in memory at all
+  if (layout.height && (!layout.tile_height || layout.tile_height > layout.height))
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  if (layout.width && layout.height > std::numeric_limits<size_t>::max() / sizeof(RGB) / layout.width)
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
 
-  archive.close();
-  delete ht;
+  // the tile index is sized from the header, which is checked against
+  // what is left of the archive first
+  if (layout.tile_count() >= size_t(end - p) / sizeof(size_t))
+  {
+    throw std::runtime_error("Corrupted archive.");
+  }
+  layout.offsets.resize(layout.tile_count() + 1);
+  for (auto &o : layout.offsets)
+  {
+    o = get_raw<size_t>(p, end);
+  }
+  if (layout.predictor == predictor_type::automatic)
+  {
+    if (layout.tile_count() > size_t(end - p) / sizeof(predictor_type))
+    {
+      throw std::runtime_error("Corrupted archive.");
+    }
+    layout.predictors.resize(layout.tile_count());
+    for (auto &predictor : layout.predictors)
+    {
+      predictor = get_raw<predictor_type>(p, end);
+    }
+  }
+  for (size_t t = 0; t < layout.tile_count(); t++)
+  {
+    if (layout.offsets[t] > layout.offsets[t + 1] || layout.offsets[t + 1] > size_t(end - p))
+    {
+      throw std::runtime_error("Corrupted archive.");
+    }
+  }
+  layout.tiles = p;
+
+  // and each tile must be able to hold its pixels
+  for (size_t t = 0; t < layout.tile_count(); t++)
+  {
+    const size_t rows = std::min(layout.tile_height, layout.height - t * layout.tile_height);
+    const uint8_t *payload = layout.tiles + layout.offsets[t];
+    const uint8_t *payload_end = layout.tiles + layout.offsets[t + 1];
+    if (layout.tile_predictor(t) != predictor_type::B)
+    {
+      if (layout.width * rows > max_stream_pixels(payload, payload_end - payload, layout.entropy))
+      {
+        throw std::runtime_error("Corrupted archive.");
+      }
+      continue;
+    }
+
+    // the segments of read_b_segments
+    size_t ends[b_segments];
+    for (auto &e : ends)
+    {
+      e = get_raw<size_t>(payload, payload_end);
+    }
+    size_t begin = 0;
+    for (size_t s = 0; s < b_segments; s++)
+    {
+      if (ends[s] < begin || ends[s] > size_t(payload_end - payload) ||
+          b_segment_size(s, layout.width, rows) > max_stream_pixels(payload + begin, ends[s] - begin, layout.entropy))
+      {
+        throw std::runtime_error("Corrupted archive.");
+      }
+      begin = ends[s];
+    }
+  }
+  return layout;
 }
 
-void decompress(const std::string &archivepath, const std::string &filepath)
+// Row by row coding for images that don't fit in memory. Only the rows the
+// predictor looks back at are kept. With Huffman a first pass over the file
+// counts the residuals and a second one codes them; the range coder needs a
+// single pass. The result is an ordinary single tile archive.
+void compress_stream(const std::string &filepath, const std::string &archivepath, const compression_settings &settings)
 {
-  std::ifstream archive(archivepath, std::ios::binary);
+  predictor_type predictor = settings.predictor;
+  const entropy_type entropy = settings.entropy;
+  if (predictor == predictor_type::C)
+  {
+    // the column zigzag needs the whole image
+    predictor = predictor_type::C_rows;
+  }
+  if (predictor != predictor_type::A && predictor != predictor_type::C_rows && predictor != predictor_type::D)
+  {
+    throw std::runtime_error("Unsupported predictor for streaming.");
+  }
+  if (entropy == entropy_type::context && predictor != predictor_type::A)
+  {
+    throw std::runtime_error("The context coder only models predictor A.");
+  }
+  if (QUANTIZATION_STEP != 1)
+  {
+    throw std::runtime_error("Streaming needs lossless quantization.");
+  }
 
-  // header
-  predictor_type predictor;
-  size_t width;
-  size_t height;
-  archive.read((char *)&predictor, sizeof(predictor));
-  archive.read((char *)&width, sizeof(width));
-  archive.read((char *)&height, sizeof(height));
-  bitmap<RGB> deltas(width, height);
+  std::ifstream in(filepath, std::ios::binary);
+  if (!in)
+  {
+    throw std::runtime_error("can't open " + filepath + " for reading");
+  }
+  archive_layout layout;
+  layout.predictor = predictor;
+  layout.entropy = entropy;
+  layout.transform = settings.transform;
+  bitmap<RGB>::read_header(in, layout.width, layout.height);
+  const std::streampos first_pixel = in.tellg();
+  const size_t width = layout.width;
+  layout.tile_height = std::max<size_t>(1, layout.height);
+
+  std::vector<RGB> rows[3] = {std::vector<RGB>(width), std::vector<RGB>(width), std::vector<RGB>(width)};
+  std::vector<RGB> delta(width);
+  std::vector<RGB> prediction(width);
+  const std::vector<RGB> blank(width);
+
+  // reads row y and predicts it into delta
+  auto next_row = [&](size_t y) {
+    const RGB *above = rows[(y + 2) % 3].data();
+    RGB *current = rows[y % 3].data();
+    stage_timer load_timer(stage::load);
+    in.read(reinterpret_cast<char *>(current), width * sizeof(RGB));
+    if (!in)
+    {
+      throw std::runtime_error("truncated image");
+    }
+    load_timer.stop();
+    count(counter::bytes_read, width * sizeof(RGB));
+
+    stage_timer timer(stage::prediction);
+    forward_transform(settings.transform, channels(current), width);
+
+    if (entropy == entropy_type::context)
+    {
+      // the context coder predicts by itself
+    }
+    else if (predictor == predictor_type::A)
+    {
+      compress_a_row(above, current, delta.data(), y, width, prediction.data(), blank.data());
+    }
+    else if (predictor == predictor_type::D)
+    {
+      compress_d_row(above, current, delta.data(), y, width);
+    }
+    else
+    {
+      compress_c_row(above, current, delta.data(), y, width);
+    }
+  };
+
+  // the end offset is patched once the tile is written
+  layout.offsets.assign(layout.tile_count() + 1, 0);
+  std::vector<uint8_t> header = write_layout(layout);
+  // like the other outputs, the archive only replaces archivepath once
+  // complete
+  temporary_file output(archivepath);
+  std::ofstream archive(output.path(), std::ios::binary);
+  archive.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+  if (layout.height)
+  {
+    coding_scratch &scratch = thread_scratch();
+    residual_histogram histogram(settings.bands, scratch);
+    if (entropy == entropy_type::huffman)
+    {
+      for (size_t y = 0; y < layout.height; y++)
+      {
+        next_row(y);
+        histogram.add(channels(delta.data()), width * 3);
+      }
+      in.clear();
+      in.seekg(first_pixel);
+    }
+
+    std::vector<uint8_t> buffer;
+    size_t written = 0;
+    residual_writer writer(buffer, entropy, histogram, scratch);
+    for (size_t y = 0; y < layout.height; y++)
+    {
+      next_row(y);
+      if (entropy == entropy_type::context)
+      {
+        writer.write_row(rows[(y + 1) % 3].data(), rows[(y + 2) % 3].data(), rows[y % 3].data(), y, width);
+      }
+      else
+      {
+        writer.write(channels(delta.data()), width * 3);
+      }
 
-  // huffman tree
-  size_t ht_size;
-  archive.read((char *)&ht_size, sizeof(ht_size));
+      if (buffer.size() >= (1 << 20))
+      {
+        stage_timer timer(stage::write);
+        archive.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+        written += buffer.size();
+        buffer.clear();
+      }
+    }
+    writer.flush();
+    stage_timer timer(stage::write);
+    archive.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    written += buffer.size();
+
+    archive.seekp(header.size() - sizeof(written));
+    archive.write(reinterpret_cast<const char *>(&written), sizeof(written));
+    count(counter::bytes_written, written);
+  }
+  count(counter::bytes_written, header.size());
+
+  archive.close();
+  if (!archive)
+  {
+    throw std::runtime_error("can't write " + archivepath);
+  }
+  output.commit();
+}
 
-  huffman_tree_factory<uint8_t> htf;
-  for (size_t i = 0; i < ht_size; i++)
+// Decodes a single tile archive row by row, writing each row as it is done.
+void decompress_stream(const std::string &archivepath, const std::string &filepath)
+{
+  mapped_file archive(archivepath);
+  count(counter::bytes_read, archive.size());
+  archive_layout layout = read_layout(archive.data(), archive.size());
+  if (layout.tile_count() > 1)
+  {
+    throw std::runtime_error("Only single tile archives can be streamed.");
+  }
+  if (layout.predictor != predictor_type::A && layout.predictor != predictor_type::C_rows &&
+      layout.predictor != predictor_type::D)
   {
-    uint8_t symbol;
-    unsigned frequency;
-    archive.read((char *)&symbol, sizeof(symbol));
-    archive.read((char *)&frequency, sizeof(frequency));
-    htf.set_frequency(symbol, frequency);
+    throw std::runtime_error("Unsupported predictor for streaming.");
   }
-  auto ht = htf.create();
 
-  // variable decoding
-  unsigned char buffer;
-  size_t buffer_index = 0;
-  auto n = ht->get_root();
-  for (size_t i = 0; i < deltas.size(); i++)
+  temporary_file output(filepath);
+  std::ofstream out(output.path(), std::ios::binary);
+  out << bitmap<RGB>::header(layout.width, layout.height);
+  if (layout.height)
   {
-    RGB &pixel = deltas.linear_pixel(i);
-    for (size_t j = 0; j < 3; j++)
+    residual_reader reader(layout.tiles, layout.offsets[1], layout.entropy, thread_scratch());
+
+    const size_t width = layout.width;
+    std::vector<RGB> rows[3] = {std::vector<RGB>(width), std::vector<RGB>(width), std::vector<RGB>(width)};
+    std::vector<RGB> delta(width);
+    for (size_t y = 0; y < layout.height; y++)
     {
-      while (!n->is_leaf())
+      const RGB *above2 = rows[(y + 1) % 3].data();
+      const RGB *above = rows[(y + 2) % 3].data();
+      RGB *current = rows[y % 3].data();
+      if (layout.entropy == entropy_type::context)
+      {
+        reader.read_row(above2, above, current, y, width);
+      }
+      else
       {
-        if (buffer_index == 0)
+        reader.read(channels(delta.data()), width * 3);
+        stage_timer timer(stage::reconstruction);
+        if (layout.predictor == predictor_type::A)
         {
-          archive.read((char *)&buffer, sizeof(buffer));
-          buffer_index = CHAR_BIT;
+          decompress_a_row(above, current, delta.data(), y, width, 0, width);
+        }
+        else if (layout.predictor == predictor_type::D)
+        {
+          decompress_d_row(above, current, delta.data(), y, width);
+        }
+        else
+        {
+          decompress_c_row(above, current, delta.data(), y, width);
         }
-        n = n->get_child((buffer >> (buffer_index - 1)) & 1);
-        buffer_index--;
       }
-      pixel[j] = n->get_symbol();
-      n = ht->get_root();
+
+      // the window stays in the transformed space, delta is free again
+      stage_timer timer(stage::reconstruction);
+      std::copy(current, current + width, delta.begin());
+      inverse_transform(layout.transform, channels(delta.data()), width);
+      timer.stop();
+
+      stage_timer write_timer(stage::write);
+      out.write(reinterpret_cast<const char *>(delta.data()), width * sizeof(RGB));
+      count(counter::bytes_written, width * sizeof(RGB));
     }
   }
-  delete ht;
-  archive.close();
 
-  bitmap<RGB> output(deltas.width(), deltas.height());
-  switch (predictor)
+  out.close();
+  if (!out)
   {
-    case predictor_type::A: decompress_a(deltas, output); break;
-    case predictor_type::B: decompress_b(deltas, output); break;
-    case predictor_type::C: decompress_c(deltas, output); break;
-    default: throw std::runtime_error("Unsupported predictor."); break;
+    throw std::runtime_error("can't write " + filepath);
+  }
+  output.commit();
+}
+
+// The image is cut in strips of tile_height rows. Each strip is coded as an
+// independent image (own predictor bootstrap, own Huffman table), so strips
+// are compressed and decompressed in parallel. Predictor A also splits its
+// rows over the pool inside a strip, which needs no tiling at all. The
+// colour transform is applied to input in place.
+void compress_tiles(bitmap<RGB> &input, const compression_settings &settings, thread_pool &pool,
+                    std::vector<uint8_t> &header, std::vector<std::vector<uint8_t>> &payloads)
+{
+  if (settings.entropy == entropy_type::context && settings.predictor != predictor_type::A)
+  {
+    throw std::runtime_error("The context coder only models predictor A.");
+  }
+
+  archive_layout layout;
+  layout.predictor = settings.predictor;
+  layout.entropy = settings.entropy;
+  layout.transform = settings.transform;
+  layout.width = input.width();
+  layout.height = input.height();
+  const size_t width = layout.width;
+  const size_t height = layout.height;
+  size_t tile_height = std::max<size_t>(1, (height + settings.tiles - 1) / std::max<size_t>(1, settings.tiles));
+  if (settings.predictor == predictor_type::B || settings.predictor == predictor_type::automatic)
+  {
+    // strips start on the coarsest grid rows, so that previews are an even
+    // subsample across strips
+    tile_height = (tile_height + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+  }
+  // never past the image, which is then a single strip
+  tile_height = std::min(tile_height, std::max<size_t>(1, height));
+  layout.tile_height = tile_height;
+
+  payloads.assign(layout.tile_count(), std::vector<uint8_t>());
+  if (settings.predictor == predictor_type::automatic)
+  {
+    layout.predictors.resize(layout.tile_count());
+  }
+  pool.parallel_for(payloads.size(), [&](size_t t) {
+    const size_t y = t * tile_height;
+    const size_t rows = std::min(tile_height, height - y);
+    bitmap<RGB> tile(width, rows, &input.pixel(0, y));
+    coding_scratch &scratch = thread_scratch();
+    stage_timer timer(stage::prediction);
+    forward_transform(settings.transform, channels(tile.data()), tile.size());
+    if (settings.entropy == entropy_type::context)
+    {
+      timer.stop();
+      write_context(payloads[t], tile, scratch);
+      return;
+    }
+    predictor_type predictor = settings.predictor;
+    if (predictor == predictor_type::automatic)
+    {
+      predictor = layout.predictors[t] = choose_predictor(tile, pool);
+    }
+    // from the buffer pool: the next tile or image reuses its pages
+    bitmap<RGB> deltas = bitmap<RGB>::uninitialised(width, rows);
+    predict(tile, deltas, predictor, pool);
+    timer.stop();
+    if (predictor == predictor_type::B)
+    {
+      write_b_segments(payloads[t], deltas, settings.entropy, settings.bands, pool, scratch);
+    }
+    else
+    {
+      write_residuals(payloads[t], deltas, settings.entropy, settings.bands, pool, scratch);
+    }
+  });
+
+  size_t offset = 0;
+  for (const auto &p : payloads)
+  {
+    layout.offsets.push_back(offset);
+    offset += p.size();
+  }
+  layout.offsets.push_back(offset);
+  header = write_layout(layout);
+}
+
+// Decodes every tile into output, which has the size of the layout.
+void decompress_tiles(const archive_layout &layout, bitmap<RGB> &output, thread_pool &pool)
+{
+  const size_t width = layout.width;
+  const size_t height = layout.height;
+  pool.parallel_for(layout.tile_count(), [&](size_t t) {
+    const size_t y = t * layout.tile_height;
+    const size_t rows = std::min(layout.tile_height, height - y);
+    const uint8_t *payload = layout.tiles + layout.offsets[t];
+    const size_t size = layout.offsets[t + 1] - layout.offsets[t];
+    bitmap<RGB> tile(width, rows, &output.pixel(0, y));
+    coding_scratch &scratch = thread_scratch();
+    if (layout.entropy == entropy_type::context)
+    {
+      read_context(payload, size, tile, scratch);
+    }
+    else
+    {
+      bitmap<RGB> deltas = bitmap<RGB>::uninitialised(width, rows);
+      if (layout.tile_predictor(t) == predictor_type::B)
+      {
+        read_b_segments(payload, size, deltas, layout.entropy, b_segments, width, rows, scratch);
+      }
+      else
+      {
+        read_residuals(payload, size, deltas, layout.entropy, scratch);
+      }
+      stage_timer timer(stage::reconstruction);
+      reconstruct(deltas, tile, layout.tile_predictor(t), pool);
+    }
+    stage_timer timer(stage::reconstruction);
+    inverse_transform(layout.transform, channels(tile.data()), tile.size());
+  });
+}
+
+// Size of the preview made of the first passes of predictor B tiles: each
+// tile starts its own grid, first_row[t] is where tile t starts. Archives
+// compressed since strips are multiples of BLOCK_SIZE rows have a single,
+// even grid; older ones repeat or skip a row where a strip restarts it.
+void preview_dimensions(const archive_layout &layout, size_t passes, size_t &width, size_t &height,
+                        std::vector<size_t> &first_row)
+{
+  const size_t step = b_step(std::min(passes, b_segments));
+  first_row.assign(layout.tile_count() + 1, 0);
+  for (size_t t = 0; t < layout.tile_count(); t++)
+  {
+    if (layout.tile_predictor(t) != predictor_type::B || layout.entropy == entropy_type::context)
+    {
+      throw std::runtime_error("Partial decoding needs predictor B.");
+    }
+    const size_t rows = std::min(layout.tile_height, layout.height - t * layout.tile_height);
+    first_row[t + 1] = first_row[t] + (rows + step - 1) / step;
+  }
+  width = (layout.width + step - 1) / step;
+  height = first_row.back();
+}
+
+// Decodes only the first passes of predictor B tiles, the pixels of the grid
+// they complete: a preview scaled down by the grid step. Only that grid is
+// stored, decoded straight into the preview rows of each tile. On the grid,
+// the passes are those of a predictor B with blocks step times smaller.
+void decompress_preview_tiles(const archive_layout &layout, size_t passes, bitmap<RGB> &preview, thread_pool &pool)
+{
+  const size_t segments = std::min(passes, b_segments);
+  const size_t step = b_step(segments);
+  size_t preview_width;
+  size_t preview_height;
+  std::vector<size_t> first_row;
+  preview_dimensions(layout, passes, preview_width, preview_height, first_row);
+
+  pool.parallel_for(layout.tile_count(), [&](size_t t) {
+    const size_t rows = std::min(layout.tile_height, layout.height - t * layout.tile_height);
+    const size_t grid_rows = first_row[t + 1] - first_row[t];
+    bitmap<RGB> deltas = bitmap<RGB>::uninitialised(preview_width, grid_rows);
+    bitmap<RGB> tile(preview_width, grid_rows, &preview.pixel(0, first_row[t]));
+    read_b_segments(layout.tiles + layout.offsets[t], layout.offsets[t + 1] - layout.offsets[t], deltas,
+                    layout.entropy, segments, layout.width, rows, thread_scratch(), step);
+    stage_timer timer(stage::reconstruction);
+    decompress_b(deltas, tile, BLOCK_SIZE / step);
+    inverse_transform(layout.transform, channels(tile.data()), tile.size());
+  });
+}
+
+// size of the image decoded with these settings, the preview one when
+// settings.passes is set
+void layout_dimensions(const archive_layout &layout, const compression_settings &settings, size_t &width,
+                       size_t &height)
+{
+  if (settings.passes)
+  {
+    std::vector<size_t> first_row;
+    preview_dimensions(layout, settings.passes, width, height, first_row);
+  }
+  else
+  {
+    width = layout.width;
+    height = layout.height;
+  }
+}
+
+// Programs linking the library skip the checks of the command line, so
+// every entry point checks the settings it is given.
+void check_settings(const compression_settings &settings)
+{
+  if (!settings.bands || settings.bands > residual_bands::max_bands)
+  {
+    throw std::invalid_argument("bands must be between 1 and " + std::to_string(residual_bands::max_bands) + ".");
+  }
+  if (!settings.tiles)
+  {
+    throw std::invalid_argument("tiles must be at least 1.");
+  }
+  if (settings.passes > b_segments)
+  {
+    throw std::invalid_argument("passes must be at most " + std::to_string(b_segments) + ".");
+  }
+}
+
+// decompress_pixels() of an archive already read
+void decompress_layout(const archive_layout &layout, uint8_t *pixels, size_t stride,
+                       const compression_settings &settings, thread_pool &pool)
+{
+  size_t width;
+  size_t height;
+  layout_dimensions(layout, settings, width, height);
+  stride = stride ? stride : width * sizeof(RGB);
+
+  // tiles decode into contiguous rows
+  const bool in_place = stride == width * sizeof(RGB);
+  bitmap<RGB> output = in_place ? bitmap<RGB>(width, height, reinterpret_cast<RGB *>(pixels))
+                                : bitmap<RGB>::uninitialised(width, height);
+  if (settings.passes)
+  {
+    decompress_preview_tiles(layout, settings.passes, output, pool);
+  }
+  else
+  {
+    decompress_tiles(layout, output, pool);
+  }
+
+  if (!in_place)
+  {
+    stage_timer timer(stage::write);
+    for (size_t y = 0; y < height; y++)
+    {
+      std::memcpy(pixels + y * stride, &output.pixel(0, y), width * sizeof(RGB));
+    }
+  }
+  count(counter::bytes_written, width * height * sizeof(RGB));
+}
+
+} // namespace
+
+void compress(const std::string &filepath, const std::string &archivepath, const compression_settings &settings,
+              thread_pool &pool)
+{
+  check_settings(settings);
+  if (settings.stream)
+  {
+    compress_stream(filepath, archivepath, settings);
+    return;
+  }
+
+  // the pixels are read in place from the mapping, so they are faulted in
+  // by the first stage that touches them. The mapping is private, the
+  // colour transform never reaches the file.
+  stage_timer load_timer(stage::load);
+  mapped_file file(filepath);
+  count(counter::bytes_read, file.size());
+  size_t width;
+  size_t height;
+  const size_t offset = bitmap<RGB>::read_header(file.data(), file.size(), width, height);
+  bitmap<RGB> input(width, height, reinterpret_cast<RGB *>(file.data() + offset));
+  load_timer.stop();
+
+  std::vector<uint8_t> header;
+  std::vector<std::vector<uint8_t>> payloads;
+  compress_tiles(input, settings, pool, header, payloads);
+
+  // like decoded images, the archive only replaces archivepath once
+  // complete, so a failed or interrupted run never leaves a truncated one
+  stage_timer timer(stage::write);
+  size_t size = header.size();
+  for (const auto &p : payloads)
+  {
+    size += p.size();
+  }
+  mapped_file archive(archivepath, size);
+  uint8_t *out = std::copy(header.begin(), header.end(), archive.data());
+  for (auto &p : payloads)
+  {
+    out = std::copy(p.begin(), p.end(), out);
+    std::vector<uint8_t>().swap(p);
+  }
+  archive.commit();
+  count(counter::bytes_written, size);
+}
+
+void decompress(const std::string &archivepath, const std::string &filepath, const compression_settings &settings,
+                thread_pool &pool)
+{
+  check_settings(settings);
+  if (settings.stream)
+  {
+    if (settings.passes)
+    {
+      throw std::runtime_error("Partial decoding can't be streamed.");
+    }
+    decompress_stream(archivepath, filepath);
+    return;
+  }
+
+  stage_timer load_timer(stage::load);
+  mapped_file archive(archivepath);
+  count(counter::bytes_read, archive.size());
+  const archive_layout layout = read_layout(archive.data(), archive.size());
+  load_timer.stop();
+
+  size_t width;
+  size_t height;
+  layout_dimensions(layout, settings, width, height);
+
+  // the image, or the preview, is decoded straight into a mapped temporary
+  // file, which only replaces the output once complete
+  stage_timer write_timer(stage::write);
+  const std::string ppm_header = bitmap<RGB>::header(width, height);
+  mapped_file file(filepath, ppm_header.size() + width * height * sizeof(RGB));
+  std::copy(ppm_header.begin(), ppm_header.end(), file.data());
+  bitmap<RGB> output(width, height, reinterpret_cast<RGB *>(file.data() + ppm_header.size()));
+  write_timer.stop();
+  count(counter::bytes_written, file.size());
+
+  if (settings.passes)
+  {
+    decompress_preview_tiles(layout, settings.passes, output, pool);
+  }
+  else
+  {
+    decompress_tiles(layout, output, pool);
   }
-  output.save(filepath);
+  file.commit();
+}
+
+std::vector<uint8_t> compress_pixels(const uint8_t *pixels, size_t width, size_t height, size_t stride,
+                                     const compression_settings &settings, thread_pool &pool)
+{
+  check_settings(settings);
+  stride = stride ? stride : width * sizeof(RGB);
+  count(counter::bytes_read, width * height * sizeof(RGB));
+
+  // tiles need contiguous rows, and the colour transform works in place:
+  // without a transform, contiguous pixels are only read
+  const bool in_place = stride == width * sizeof(RGB) && settings.transform == colour_transform::none;
+  bitmap<RGB> input = in_place ? bitmap<RGB>(width, height, reinterpret_cast<RGB *>(const_cast<uint8_t *>(pixels)))
+                               : bitmap<RGB>::uninitialised(width, height);
+  if (!in_place)
+  {
+    stage_timer timer(stage::load);
+    for (size_t y = 0; y < height; y++)
+    {
+      std::memcpy(&input.pixel(0, y), pixels + y * stride, width * sizeof(RGB));
+    }
+  }
+
+  std::vector<uint8_t> archive;
+  std::vector<std::vector<uint8_t>> payloads;
+  compress_tiles(input, settings, pool, archive, payloads);
+
+  stage_timer timer(stage::write);
+  size_t size = archive.size();
+  for (const auto &p : payloads)
+  {
+    size += p.size();
+  }
+  archive.reserve(size);
+  for (auto &p : payloads)
+  {
+    archive.insert(archive.end(), p.begin(), p.end());
+    std::vector<uint8_t>().swap(p);
+  }
+  count(counter::bytes_written, archive.size());
+  return archive;
+}
+
+std::vector<uint8_t> compress_ppm(const uint8_t *ppm, size_t size, const compression_settings &settings,
+                                  thread_pool &pool)
+{
+  size_t width;
+  size_t height;
+  const size_t offset = bitmap<RGB>::read_header(ppm, size, width, height);
+  return compress_pixels(ppm + offset, width, height, 0, settings, pool);
+}
+
+void archive_dimensions(const uint8_t *archive, size_t size, size_t &width, size_t &height,
+                        const compression_settings &settings)
+{
+  check_settings(settings);
+  layout_dimensions(read_layout(archive, size), settings, width, height);
+}
+
+void decompress_pixels(const uint8_t *archive, size_t size, uint8_t *pixels, size_t stride,
+                       const compression_settings &settings, thread_pool &pool)
+{
+  check_settings(settings);
+  count(counter::bytes_read, size);
+  decompress_layout(read_layout(archive, size), pixels, stride, settings, pool);
+}
+
+std::vector<uint8_t> decompress_ppm(const uint8_t *archive, size_t size, const compression_settings &settings,
+                                    thread_pool &pool)
+{
+  check_settings(settings);
+  count(counter::bytes_read, size);
+  const archive_layout layout = read_layout(archive, size);
+  size_t width;
+  size_t height;
+  layout_dimensions(layout, settings, width, height);
+  const std::string header = bitmap<RGB>::header(width, height);
+  std::vector<uint8_t> ppm(header.size() + width * height * sizeof(RGB));
+  std::copy(header.begin(), header.end(), ppm.begin());
+  decompress_layout(layout, ppm.data() + header.size(), 0, settings, pool);
+  return ppm;
+}
+
+void compress(const std::string &filepath, const std::string &archivepath, const compression_settings &settings)
+{
+  thread_pool pool(settings.threads);
+  compress(filepath, archivepath, settings, pool);
+}
+
+void decompress(const std::string &archivepath, const std::string &filepath, const compression_settings &settings)
+{
+  thread_pool pool(settings.threads);
+  decompress(archivepath, filepath, settings, pool);
+}
+
+std::vector<uint8_t> compress_pixels(const uint8_t *pixels, size_t width, size_t height, size_t stride,
+                                     const compression_settings &settings)
+{
+  thread_pool pool(settings.threads);
+  return compress_pixels(pixels, width, height, stride, settings, pool);
+}
+
+std::vector<uint8_t> compress_ppm(const uint8_t *ppm, size_t size, const compression_settings &settings)
+{
+  thread_pool pool(settings.threads);
+  return compress_ppm(ppm, size, settings, pool);
+}
+
+void decompress_pixels(const uint8_t *archive, size_t size, uint8_t *pixels, size_t stride,
+                       const compression_settings &settings)
+{
+  thread_pool pool(settings.threads);
+  decompress_pixels(archive, size, pixels, stride, settings, pool);
+}
+
+std::vector<uint8_t> decompress_ppm(const uint8_t *archive, size_t size, const compression_settings &settings)
+{
+  thread_pool pool(settings.threads);
+  return decompress_ppm(archive, size, settings, pool);
 }
@@ -0,0 +1,80 @@
+#include "context_model.hpp"
+#include "prediction_a.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+// CALIC's activity thresholds
+size_t quantize_activity(int activity)
+{
+  return (activity >= 5) + (activity >= 15) + (activity >= 25) + (activity >= 42) + (activity >= 60) +
+         (activity >= 85) + (activity >= 140);
+}
+} // namespace
+
+template <typename Code>
+void context_model::code_row(const uint8_t *above2, const uint8_t *above, uint8_t *current, size_t y, size_t width,
+                             Code code)
+{
+  int left_error[3] = {};
+  for (size_t x = 0; x < width; x++)
+  {
+    int channel_error = 0;
+    for (size_t c = 0; c < 3; c++)
+    {
+      // missing neighbours fall back on the nearest known one
+      const size_t i = 3 * x + c;
+      const bool right = x + 1 < width;
+      const int w = x ? current[i - 3] : (y ? above[i] : 0);
+      const int ww = x > 1 ? current[i - 6] : w;
+      const int n = y ? above[i] : w;
+      const int nw = y && x ? above[i - 3] : n;
+      const int ne = y && right ? above[i + 3] : n;
+      const int nn = y > 1 ? above2[i] : n;
+      const int nne = y > 1 && right ? above2[i + 3] : ne;
+
+      const int p = prediction_a(w, ww, n, nw, ne);
+      const int dh = std::abs(w - ww) + std::abs(n - nw) + std::abs(n - ne);
+      const int dv = std::abs(w - nw) + std::abs(n - nn) + std::abs(ne - nne);
+      const size_t level = quantize_activity(dh + dv + 2 * std::abs(left_error[c]) + std::abs(channel_error));
+
+      const unsigned texture = (n < p) | (w < p) << 1 | (nw < p) << 2 | (ne < p) << 3 | (nn < p) << 4 |
+                               (ww < p) << 5 | (2 * n - nn < p) << 6 | (2 * w - ww < p) << 7;
+      bias &b = biases[(c * (activity_levels / 2) + level / 2) * texture_patterns + texture];
+      const int corrected = std::min(255, std::max(0, p + (b.count ? b.sum / b.count : 0)));
+
+      const int error = code(models[c * activity_levels + level], corrected, current[i]);
+
+      b.sum += error;
+      if (++b.count == 128)
+      {
+        b.sum /= 2;
+        b.count /= 2;
+      }
+      left_error[c] = error;
+      channel_error = error;
+    }
+  }
+}
+
+void context_model::encode_row(range_encoder &rc, const uint8_t *above2, const uint8_t *above, const uint8_t *current,
+                               size_t y, size_t width)
+{
+  // the row is only read when encoding
+  code_row(above2, above, const_cast<uint8_t *>(current), y, width,
+           [&rc](byte_model &model, int prediction, uint8_t &value) {
+             model.encode(rc, fold(uint8_t(value - prediction)));
+             return value - prediction;
+           });
+}
+
+void context_model::decode_row(range_decoder &rc, const uint8_t *above2, const uint8_t *above, uint8_t *current,
+                               size_t y, size_t width)
+{
+  code_row(above2, above, current, y, width, [&rc](byte_model &model, int prediction, uint8_t &value) {
+    value = uint8_t(prediction + unfold(model.decode(rc)));
+    return value - prediction;
+  });
+}
@@ -0,0 +1,152 @@
+#include "instrumentation.hpp"
+
+#include <iomanip>
+
+namespace
+{
+std::atomic<profile *> collector(nullptr);
+
+#ifndef CODEC_NO_INSTRUMENTATION
+std::atomic<size_t> buffers_in_use(0);
+std::atomic<size_t> peak(0);
+#endif
+
+// small numbers for trace viewers, in order of first use
+uint32_t thread_number()
+{
+  static std::atomic<uint32_t> next(0);
+  thread_local uint32_t number = next++;
+  return number;
+}
+} // namespace
+
+#ifndef CODEC_NO_INSTRUMENTATION
+// Counted by the buffer pool, once per bitmap: rare enough for two atomics
+// even when nothing is collected, which keeps acquires and releases paired.
+void note_buffer_acquired(size_t bytes)
+{
+  size_t now = buffers_in_use += bytes;
+  size_t seen = peak.load(std::memory_order_relaxed);
+  while (now > seen && !peak.compare_exchange_weak(seen, now))
+  {
+  }
+}
+
+void note_buffer_released(size_t bytes)
+{
+  buffers_in_use -= bytes;
+}
+
+size_t peak_buffer_bytes()
+{
+  return peak;
+}
+#else
+size_t peak_buffer_bytes()
+{
+  return 0;
+}
+#endif
+
+const char *stage_name(stage s)
+{
+  switch (s)
+  {
+    case stage::load: return "load";
+    case stage::prediction: return "prediction";
+    case stage::histogram: return "histogram";
+    case stage::tree: return "tree";
+    case stage::packing: return "packing";
+    case stage::write: return "write";
+    case stage::decode: return "decode";
+    default:
+    case stage::reconstruction: return "reconstruction";
+  }
+}
+
+profile::profile(bool tracing_) : created(std::chrono::steady_clock::now()), tracing(tracing_)
+{
+  for (auto &n : nanoseconds)
+  {
+    n = 0;
+  }
+  for (auto &c : counts)
+  {
+    c = 0;
+  }
+}
+
+void profile::add(stage s, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+  const uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  nanoseconds[size_t(s)] += duration;
+  if (tracing)
+  {
+    const uint64_t offset = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - created).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back({s, thread_number(), offset, duration});
+  }
+}
+
+void profile::print_summary(std::ostream &out) const
+{
+#ifdef CODEC_NO_INSTRUMENTATION
+  out << "instrumentation compiled out (make INSTRUMENTATION=0)" << std::endl;
+#endif
+  const std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+  for (size_t s = 0; s < stage_count; s++)
+  {
+    if (nanoseconds[s])
+    {
+      out << std::left << std::setw(16) << stage_name(stage(s)) << std::right << std::setw(10)
+          << seconds(stage(s)) << " s" << std::endl;
+    }
+  }
+
+  const double symbols = count(counter::symbols);
+  const double bits = count(counter::bits);
+  const double coding = seconds(stage::packing) + seconds(stage::decode);
+  out << std::setprecision(2);
+  out << "symbols         " << std::setw(14) << uint64_t(symbols);
+  if (coding > 0)
+  {
+    out << "  (" << symbols / coding / 1e6 << " M/s)";
+  }
+  out << std::endl;
+  out << "bits            " << std::setw(14) << uint64_t(bits);
+  if (symbols > 0)
+  {
+    out << "  (" << bits / symbols << " bits/symbol)";
+  }
+  out << std::endl;
+  out << "bytes read      " << std::setw(14) << count(counter::bytes_read) << std::endl;
+  out << "bytes written   " << std::setw(14) << count(counter::bytes_written) << std::endl;
+  out << "peak buffers    " << std::setw(14) << peak_buffer_bytes() << std::endl;
+  out.flags(flags);
+}
+
+void profile::write_trace(std::ostream &out) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  const std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    const event &e = events[i];
+    out << (i ? ",\n" : "\n") << "{\"name\":\"" << stage_name(e.s) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+        << ",\"ts\":" << e.begin / 1e3 << ",\"dur\":" << e.duration / 1e3 << '}';
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  out.flags(flags);
+}
+
+void collect_profile(profile *p)
+{
+  collector = p;
+}
+
+profile *collected_profile()
+{
+  return collector.load(std::memory_order_relaxed);
+}
@@ -1,21 +1,102 @@
+#include <fstream>
 #include <iostream>
 #include <map>
 
+#include "batch.hpp"
 #include "compression.hpp"
+#include "instrumentation.hpp"
 #include "options.hpp"
 
+// prints failures and aggregate throughput, returns the exit status
+int report(const batch_report &r, bool compressing)
+{
+  for (const auto &e : r.errors)
+  {
+    std::cerr << e << std::endl;
+  }
+  const size_t image_bytes = compressing ? r.bytes_read : r.bytes_written;
+  std::cout << r.files - r.errors.size() << '/' << r.files << " files, " << r.bytes_read / 1e6 << " MB read, "
+            << r.bytes_written / 1e6 << " MB written in " << r.seconds << " s (";
+  // a clock too coarse for a tiny batch has no rate to give
+  if (r.seconds > 0)
+  {
+    std::cout << image_bytes / 1e6 / r.seconds;
+  }
+  else
+  {
+    std::cout << '-';
+  }
+  std::cout << " MB/s of images)" << std::endl;
+  return r.errors.empty() ? 0 : 1;
+}
+
+// collects a profile while it lives when -v or --trace asks for one
+class profiling
+{
+public:
+  explicit profiling(const options &opt_) : opt(opt_), p(!opt.trace.empty())
+  {
+    if (opt.verbose || !opt.trace.empty())
+    {
+      collect_profile(&p);
+    }
+  }
+
+  ~profiling()
+  {
+    if (collected_profile() != &p)
+    {
+      return;
+    }
+    collect_profile(nullptr);
+    if (opt.verbose)
+    {
+      p.print_summary(std::clog);
+    }
+    if (!opt.trace.empty())
+    {
+      std::ofstream out(opt.trace);
+      p.write_trace(out);
+      if (!out)
+      {
+        std::cerr << "can't write " << opt.trace << std::endl;
+      }
+    }
+  }
+
+private:
+  const options &opt;
+  profile p;
+};
+
 int main(int argc, char *argv[])
 {
   try
   {
     options opt(argc, argv);
 
+    compression_settings settings;
+    settings.predictor = opt.predictor;
+    settings.entropy = opt.entropy;
+    settings.bands = opt.bands;
+    settings.transform = opt.transform;
+    settings.tiles = opt.tiles;
+    settings.threads = opt.threads;
+    settings.stream = opt.stream;
+    settings.passes = opt.passes;
+
+    profiling instrumentation(opt);
+    if (opt.batch && !opt.help && !opt.version)
+    {
+      return report(run_batch(opt.input, opt.output, opt.compress, settings), opt.compress);
+    }
+
     switch (first_of({opt.help, opt.version, opt.compress}))
     {
       case 0: options::show_help(); break;
       case 1: options::show_version(); break;
-      case 2: compress(opt.input, opt.output, opt.predictor); break;
-      default: decompress(opt.input, opt.output); break;
+      case 2: compress(opt.input, opt.output, settings); break;
+      default: decompress(opt.input, opt.output, settings); break;
     }
   }
   catch (boost::program_options::error &this_exception)
@@ -23,5 +104,11 @@ int main(int argc, char *argv[])
     std::cerr << this_exception.what() << std::endl;
     return 1;
   }
+  // unwinds, so that partial outputs are removed
+  catch (std::exception &this_exception)
+  {
+    std::cerr << this_exception.what() << std::endl;
+    return 1;
+  }
   return 0;
 }
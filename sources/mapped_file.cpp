@@ -0,0 +1,154 @@
+#include "mapped_file.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+std::runtime_error system_error(const std::string &what, const std::string &filename)
+{
+  return std::runtime_error(what + " " + filename + ": " + std::strerror(errno));
+}
+
+// next to filename, so that rename() stays within one file system; unique
+// between the threads of a batch and between processes
+std::string temporary_name(const std::string &filename)
+{
+  static std::atomic<unsigned> next(0);
+  return filename + ".tmp" + std::to_string(getpid()) + "." + std::to_string(next++);
+}
+
+// moves temporary over target, or removes it
+void replace(const std::string &temporary, const std::string &target)
+{
+  if (rename(temporary.c_str(), target.c_str()) < 0)
+  {
+    const int error = errno;
+    unlink(temporary.c_str());
+    errno = error;
+    throw system_error("can't write", target);
+  }
+}
+} // namespace
+
+mapped_file::mapped_file(const std::string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw system_error("can't open", filename);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+  {
+    close(fd);
+    throw system_error("can't stat", filename);
+  }
+
+  length = st.st_size;
+  if (length)
+  {
+    void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      close(fd);
+      throw system_error("can't map", filename);
+    }
+    bytes = static_cast<uint8_t *>(p);
+    madvise(p, length, MADV_SEQUENTIAL);
+  }
+  close(fd);
+}
+
+mapped_file::mapped_file(const std::string &filename, size_t size)
+    : target(filename), temporary(temporary_name(filename))
+{
+  int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+  {
+    throw system_error("can't create", temporary);
+  }
+
+  // the blocks are reserved now: a full disk is an error here rather than
+  // a SIGBUS when a page of the mapping is first written
+  if (size)
+  {
+    if (int error = posix_fallocate(fd, 0, size))
+    {
+      close(fd);
+      unlink(temporary.c_str());
+      errno = error;
+      throw system_error("can't allocate", filename);
+    }
+  }
+
+  length = size;
+  if (length)
+  {
+    void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      close(fd);
+      unlink(temporary.c_str());
+      throw system_error("can't map", filename);
+    }
+    bytes = static_cast<uint8_t *>(p);
+  }
+  close(fd);
+}
+
+void mapped_file::commit()
+{
+  if (bytes)
+  {
+    munmap(bytes, length);
+    bytes = nullptr;
+  }
+  replace(temporary, target);
+  temporary.clear();
+}
+
+mapped_file::~mapped_file()
+{
+  if (bytes)
+  {
+    munmap(bytes, length);
+  }
+  if (!temporary.empty())
+  {
+    unlink(temporary.c_str());
+  }
+}
+
+temporary_file::temporary_file(const std::string &filename)
+    : target(filename), temporary(temporary_name(filename))
+{
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+  {
+    throw system_error("can't create", temporary);
+  }
+  close(fd);
+}
+
+void temporary_file::commit()
+{
+  replace(temporary, target);
+  temporary.clear();
+}
+
+temporary_file::~temporary_file()
+{
+  if (!temporary.empty())
+  {
+    unlink(temporary.c_str());
+  }
+}
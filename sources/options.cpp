@@ -31,7 +31,9 @@ namespace {
     ;
 
    debug.add_options()
-    ("verbose,v","sets verbose")
+    ("verbose,v","prints the time of each stage, bits per symbol, bytes read and written and peak memory of the images")
+    ("trace",boost::program_options::value<std::string>(),
+     "writes the timed stages to this file as Chrome trace events (chrome://tracing, Perfetto)")
     ;
 
    files.add_options()
@@ -39,12 +41,27 @@ namespace {
      "if neither -i or --input specified, unqualified argument is treated as input filename")
     ("output,o",boost::program_options::value<std::string>(),
      "specifies output file")
+    ("batch,B",
+     "input is a directory, a glob pattern or a manifest file listing one file per line, output a directory; the files are coded in parallel")
     ;
 
    compression.add_options()
-    ("predictor,p",boost::program_options::value<std::string>(), "followed A, B, or C")
+    ("predictor,p",boost::program_options::value<std::string>(), "followed A, B, C, D or auto")
+    ("entropy,e",boost::program_options::value<std::string>(),
+     "followed by huffman (static, default), range (adaptive, single pass) or context (CALIC contexts, predictor A)")
+    ("bands,b",boost::program_options::value<size_t>(),
+     "Huffman tables per channel, chosen by the magnitude of recent residuals, 1 to 9 (default 1)")
+    ("transform,x",boost::program_options::value<std::string>(),
+     "followed by none (default), rct or ycocg: reversible colour transform before prediction")
     ("compress,c","Compresses a ppm file and produces a compressed file)")
     ("decompress,d","Decompresses a file and procudes a .ppm")
+    ("tiles,t",boost::program_options::value<size_t>(),
+     "cuts the image in this many row strips coded independently (default 1)")
+    ("threads,j",boost::program_options::value<size_t>(),
+     "worker threads, 0 for one per core (default 0)")
+    ("passes,n",boost::program_options::value<size_t>(),
+     "decompresses a preview from the first passes of predictor B: 1 gives 1/8 scale, 2 1/4, 3 1/2")
+    ("stream,s","codes row by row with memory bounded by the image width (predictors A, C and D, one tile)")
     ;
 
 
@@ -131,6 +148,7 @@ options::options(int argc, const char * const argv[])
   help=vm.count("help");
   version=vm.count("version");
   verbose=vm.count("verbose");
+  if (vm.count("trace")) trace=vm["trace"].as<std::string>();
 
   // mutual-exclusion test
   if (!at_most_one<bool>(
@@ -162,15 +180,63 @@ options::options(int argc, const char * const argv[])
        case hash("A"): predictor = predictor_type::A; break;
        case hash("B"): predictor = predictor_type::B; break;
        case hash("C"): predictor = predictor_type::C; break;
+       case hash("D"): predictor = predictor_type::D; break;
+       case hash("auto"): predictor = predictor_type::automatic; break;
        default: throw boost::program_options::error("unknown predictor " + vm["predictor"].as<std::string>());
      }
    }
   else
    predictor=predictor_type::A;
 
+  if (vm.count("entropy"))
+   {
+    switch (hash(vm["entropy"].as<std::string>() ))
+     {
+       case hash("huffman"): entropy = entropy_type::huffman; break;
+       case hash("range"): entropy = entropy_type::range; break;
+       case hash("context"): entropy = entropy_type::context; break;
+       default: throw boost::program_options::error("unknown entropy coder " + vm["entropy"].as<std::string>());
+     }
+   }
+
+  if (vm.count("bands"))
+   {
+    bands=vm["bands"].as<size_t>();
+    if (bands<1 || bands>9)
+     throw boost::program_options::error("bands must be between 1 and 9");
+   }
+
+  if (vm.count("transform"))
+   {
+    switch (hash(vm["transform"].as<std::string>() ))
+     {
+       case hash("none"): transform = colour_transform::none; break;
+       case hash("rct"): transform = colour_transform::rct; break;
+       case hash("ycocg"): transform = colour_transform::ycocg; break;
+       default: throw boost::program_options::error("unknown colour transform " + vm["transform"].as<std::string>());
+     }
+   }
+
+  if (vm.count("tiles"))
+   {
+    tiles=vm["tiles"].as<size_t>();
+    if (tiles==0)
+     throw boost::program_options::error("tiles must be at least 1");
+   }
+  if (vm.count("threads")) threads=vm["threads"].as<size_t>();
+  stream=vm.count("stream");
+  if (vm.count("passes"))
+   {
+    passes=vm["passes"].as<size_t>();
+    if (passes==0)
+     throw boost::program_options::error("passes must be at least 1");
+   }
+
   compress=!vm.count("decompress");
+  batch=vm.count("batch");
 
   // other consistancy checks
-
+  if (stream && passes)
+   throw boost::program_options::error("passes can't be used with stream, which only decodes whole images");
 
  }
@@ -0,0 +1,138 @@
+#include "prediction_a.hpp"
+#include "cpu_dispatch.hpp"
+
+#ifdef CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+typedef void (*row_kernel)(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, size_t, size_t);
+
+void predict_row_a_scalar(const uint8_t *above, const uint8_t *current, const uint8_t *north_east,
+                          uint8_t *prediction, size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; i++)
+  {
+    prediction[i] = prediction_a(current[i - 3], current[i - 6], above[i], above[i - 3], north_east[i]);
+  }
+}
+
+#ifdef CPU_DISPATCH_X86
+
+// 8 channels per iteration, in 16-bit lanes
+__attribute__((target("sse4.1"))) void predict_row_a_sse41(const uint8_t *above, const uint8_t *current,
+                                                             const uint8_t *north_east, uint8_t *prediction,
+                                                             size_t begin, size_t end)
+{
+  const __m128i low_byte = _mm_set1_epi16(0xff);
+  const __m128i three = _mm_set1_epi16(3);
+  const __m128i t8 = _mm_set1_epi16(8), t32 = _mm_set1_epi16(32), t80 = _mm_set1_epi16(80);
+  const __m128i m8 = _mm_set1_epi16(-8), m32 = _mm_set1_epi16(-32), m80 = _mm_set1_epi16(-80);
+
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8)
+  {
+    __m128i w = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(current + i - 3)));
+    __m128i ww = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(current + i - 6)));
+    __m128i n = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(above + i)));
+    __m128i nw = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(above + i - 3)));
+    __m128i ne = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(north_east + i)));
+
+    __m128i dh = _mm_add_epi16(_mm_add_epi16(_mm_abs_epi16(_mm_sub_epi16(w, ww)), _mm_abs_epi16(_mm_sub_epi16(n, nw))),
+                               _mm_abs_epi16(_mm_sub_epi16(ne, n)));
+    __m128i dv = _mm_add_epi16(_mm_add_epi16(_mm_abs_epi16(_mm_sub_epi16(w, ww)), _mm_abs_epi16(_mm_sub_epi16(n, nw))),
+                               _mm_abs_epi16(_mm_sub_epi16(ne, n)));
+    __m128i d = _mm_sub_epi16(dh, dv);
+
+    // (ne - nw) / 4 rounds toward zero
+    __m128i g = _mm_sub_epi16(ne, nw);
+    g = _mm_srai_epi16(_mm_add_epi16(g, _mm_and_si128(_mm_srai_epi16(g, 15), three)), 2);
+    __m128i base = _mm_and_si128(_mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(n, w), 1), g), low_byte);
+    __m128i base3 = _mm_mullo_epi16(base, three);
+
+    __m128i p = base;
+    p = _mm_blendv_epi8(p, _mm_srli_epi16(_mm_add_epi16(base3, w), 2), _mm_cmplt_epi16(d, m8));
+    p = _mm_blendv_epi8(p, _mm_srli_epi16(_mm_add_epi16(base3, n), 2), _mm_cmpgt_epi16(d, t8));
+    p = _mm_blendv_epi8(p, _mm_srli_epi16(_mm_add_epi16(base, w), 1), _mm_cmplt_epi16(d, m32));
+    p = _mm_blendv_epi8(p, _mm_srli_epi16(_mm_add_epi16(base, n), 1), _mm_cmpgt_epi16(d, t32));
+    p = _mm_blendv_epi8(p, w, _mm_cmplt_epi16(d, m80));
+    p = _mm_blendv_epi8(p, n, _mm_cmpgt_epi16(d, t80));
+
+    _mm_storel_epi64((__m128i *)(prediction + i), _mm_packus_epi16(p, p));
+  }
+  predict_row_a_scalar(above, current, north_east, prediction, i, end);
+}
+
+// 16 channels per iteration, in 16-bit lanes
+__attribute__((target("avx2"))) void predict_row_a_avx2(const uint8_t *above, const uint8_t *current,
+                                                          const uint8_t *north_east, uint8_t *prediction,
+                                                          size_t begin, size_t end)
+{
+  const __m256i low_byte = _mm256_set1_epi16(0xff);
+  const __m256i three = _mm256_set1_epi16(3);
+  const __m256i t8 = _mm256_set1_epi16(8), t32 = _mm256_set1_epi16(32), t80 = _mm256_set1_epi16(80);
+  const __m256i m8 = _mm256_set1_epi16(-8), m32 = _mm256_set1_epi16(-32), m80 = _mm256_set1_epi16(-80);
+
+  size_t i = begin;
+  for (; i + 16 <= end; i += 16)
+  {
+    __m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(current + i - 3)));
+    __m256i ww = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(current + i - 6)));
+    __m256i n = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(above + i)));
+    __m256i nw = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(above + i - 3)));
+    __m256i ne = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(north_east + i)));
+
+    __m256i dh = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(w, ww)), _mm256_abs_epi16(_mm256_sub_epi16(n, nw))),
+        _mm256_abs_epi16(_mm256_sub_epi16(ne, n)));
+    __m256i dv = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(w, ww)), _mm256_abs_epi16(_mm256_sub_epi16(n, nw))),
+        _mm256_abs_epi16(_mm256_sub_epi16(ne, n)));
+    __m256i d = _mm256_sub_epi16(dh, dv);
+
+    // (ne - nw) / 4 rounds toward zero
+    __m256i g = _mm256_sub_epi16(ne, nw);
+    g = _mm256_srai_epi16(_mm256_add_epi16(g, _mm256_and_si256(_mm256_srai_epi16(g, 15), three)), 2);
+    __m256i base = _mm256_and_si256(_mm256_add_epi16(_mm256_srli_epi16(_mm256_add_epi16(n, w), 1), g), low_byte);
+    __m256i base3 = _mm256_mullo_epi16(base, three);
+
+    __m256i p = base;
+    p = _mm256_blendv_epi8(p, _mm256_srli_epi16(_mm256_add_epi16(base3, w), 2), _mm256_cmpgt_epi16(m8, d));
+    p = _mm256_blendv_epi8(p, _mm256_srli_epi16(_mm256_add_epi16(base3, n), 2), _mm256_cmpgt_epi16(d, t8));
+    p = _mm256_blendv_epi8(p, _mm256_srli_epi16(_mm256_add_epi16(base, w), 1), _mm256_cmpgt_epi16(m32, d));
+    p = _mm256_blendv_epi8(p, _mm256_srli_epi16(_mm256_add_epi16(base, n), 1), _mm256_cmpgt_epi16(d, t32));
+    p = _mm256_blendv_epi8(p, w, _mm256_cmpgt_epi16(m80, d));
+    p = _mm256_blendv_epi8(p, n, _mm256_cmpgt_epi16(d, t80));
+
+    __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(p), _mm256_extracti128_si256(p, 1));
+    _mm_storeu_si128((__m128i *)(prediction + i), packed);
+  }
+  predict_row_a_scalar(above, current, north_east, prediction, i, end);
+}
+
+#endif
+
+row_kernel select_row_kernel()
+{
+#ifdef CPU_DISPATCH_X86
+  if (cpu_supports(instruction_set::avx2))
+  {
+    return predict_row_a_avx2;
+  }
+  if (cpu_supports(instruction_set::sse41))
+  {
+    return predict_row_a_sse41;
+  }
+#endif
+  return predict_row_a_scalar;
+}
+
+const row_kernel row_kernel_selected = select_row_kernel();
+} // namespace
+
+void predict_row_a(const uint8_t *above, const uint8_t *current, const uint8_t *north_east, uint8_t *prediction,
+                   size_t begin, size_t end)
+{
+  row_kernel_selected(above, current, north_east, prediction, begin, end);
+}
@@ -0,0 +1,25 @@
+#include "prediction_d.hpp"
+#include "cpu_dispatch.hpp"
+
+namespace
+{
+typedef void (*row_kernel)(const uint8_t *, const uint8_t *, uint8_t *, size_t, size_t);
+
+inline __attribute__((always_inline)) void residual_row(const uint8_t *__restrict above,
+                                                        const uint8_t *__restrict current, uint8_t *__restrict delta,
+                                                        size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; i++)
+  {
+    delta[i] = current[i] - prediction_d(current[i - 3], above[i], above[i - 3]);
+  }
+}
+
+const row_kernel row_kernel_selected =
+    plain_kernel<void(const uint8_t *, const uint8_t *, uint8_t *, size_t, size_t), residual_row>::select();
+} // namespace
+
+void residual_row_d(const uint8_t *above, const uint8_t *current, uint8_t *delta, size_t begin, size_t end)
+{
+  row_kernel_selected(above, current, delta, begin, end);
+}
@@ -0,0 +1,97 @@
+// Settings out of range must be rejected by every entry point of the
+// library, neither crashing nor writing archives that can't be read back:
+//
+//   make check
+
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "compression.hpp"
+
+namespace
+{
+const size_t width = 16;
+const size_t height = 16;
+
+std::vector<uint8_t> test_pixels()
+{
+  std::vector<uint8_t> pixels(width * height * 3);
+  for (size_t i = 0; i < pixels.size(); i++)
+  {
+    pixels[i] = uint8_t(i * 7);
+  }
+  return pixels;
+}
+
+// only std::invalid_argument counts, any other error means the settings
+// went through
+bool rejected(const std::function<void()> &f)
+{
+  try
+  {
+    f();
+  }
+  catch (std::invalid_argument &)
+  {
+    return true;
+  }
+  catch (std::exception &)
+  {
+  }
+  return false;
+}
+} // namespace
+
+int main()
+{
+  const std::vector<uint8_t> pixels = test_pixels();
+  compression_settings valid;
+  valid.threads = 1;
+  valid.predictor = predictor_type::B;
+  const std::vector<uint8_t> archive = compress_pixels(pixels.data(), width, height, 0, valid);
+  const std::vector<uint8_t> ppm = decompress_ppm(archive.data(), archive.size(), valid);
+
+  struct
+  {
+    const char *name;
+    size_t compression_settings::*field;
+    size_t value;
+  } cases[] = {
+      {"bands 0", &compression_settings::bands, 0},
+      {"bands 10", &compression_settings::bands, 10},
+      {"tiles 0", &compression_settings::tiles, 0},
+      {"passes 5", &compression_settings::passes, 5},
+  };
+
+  int failures = 0;
+  for (const auto &c : cases)
+  {
+    compression_settings settings = valid;
+    settings.*c.field = c.value;
+    std::vector<uint8_t> decoded(pixels.size());
+    size_t w;
+    size_t h;
+    // the files don't exist: settings must be checked before they are opened
+    const std::function<void()> entry_points[] = {
+        [&] { compress_pixels(pixels.data(), width, height, 0, settings); },
+        [&] { compress_ppm(ppm.data(), ppm.size(), settings); },
+        [&] { compress("missing.ppm", "missing.blp", settings); },
+        [&] { decompress_pixels(archive.data(), archive.size(), decoded.data(), 0, settings); },
+        [&] { decompress_ppm(archive.data(), archive.size(), settings); },
+        [&] { archive_dimensions(archive.data(), archive.size(), w, h, settings); },
+        [&] { decompress("missing.blp", "missing.ppm", settings); },
+    };
+    for (size_t e = 0; e < sizeof(entry_points) / sizeof(entry_points[0]); e++)
+    {
+      if (!rejected(entry_points[e]))
+      {
+        std::cerr << c.name << ": accepted by entry point " << e << std::endl;
+        failures++;
+      }
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+// Archives with a corrupted header or tile index must be rejected before
+// anything is decoded:
+//
+//   make check
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "compression.hpp"
+
+namespace
+{
+const size_t width = 16;
+const size_t height = 16;
+
+// fields of the archive header, in order
+const size_t width_offset = sizeof(predictor_type) + sizeof(entropy_type) + sizeof(colour_transform);
+const size_t height_offset = width_offset + sizeof(size_t);
+const size_t tile_height_offset = height_offset + sizeof(size_t);
+const size_t offsets_offset = tile_height_offset + sizeof(size_t);
+
+std::vector<uint8_t> valid_archive(predictor_type predictor = predictor_type::A,
+                                   entropy_type entropy = entropy_type::huffman)
+{
+  std::vector<uint8_t> pixels(width * height * 3);
+  for (size_t i = 0; i < pixels.size(); i++)
+  {
+    pixels[i] = uint8_t(i * 7);
+  }
+  compression_settings settings;
+  settings.threads = 1;
+  settings.predictor = predictor;
+  settings.entropy = entropy;
+  return compress_pixels(pixels.data(), width, height, 0, settings);
+}
+
+std::vector<uint8_t> with_field(std::vector<uint8_t> archive, size_t offset, size_t value)
+{
+  std::memcpy(archive.data() + offset, &value, sizeof(value));
+  return archive;
+}
+
+// an archive claiming height rows in tiles of tile_height
+std::vector<uint8_t> with_size(std::vector<uint8_t> archive, size_t width, size_t height, size_t tile_height)
+{
+  archive = with_field(archive, width_offset, width);
+  archive = with_field(archive, height_offset, height);
+  return with_field(archive, tile_height_offset, tile_height);
+}
+
+// as many single row tiles as there is room for their offsets, but not for
+// their predictors too
+std::vector<uint8_t> with_automatic_tiles(std::vector<uint8_t> archive)
+{
+  const predictor_type automatic = predictor_type::automatic;
+  std::memcpy(archive.data(), &automatic, sizeof(automatic));
+  const size_t tiles = (archive.size() - offsets_offset) / sizeof(size_t) - 1;
+  return with_size(archive, 1, tiles, 1);
+}
+
+bool rejected(const std::vector<uint8_t> &archive)
+{
+  compression_settings settings;
+  settings.threads = 1;
+  try
+  {
+    decompress_ppm(archive.data(), archive.size(), settings);
+  }
+  catch (std::runtime_error &)
+  {
+    return true;
+  }
+  return false;
+}
+} // namespace
+
+int main()
+{
+  const size_t huge = std::numeric_limits<size_t>::max();
+  const std::vector<uint8_t> archive = valid_archive();
+  const std::vector<uint8_t> range_archive = valid_archive(predictor_type::A, entropy_type::range);
+  const std::vector<uint8_t> b_archive = valid_archive(predictor_type::B);
+  const size_t tall = size_t(1) << 40;
+
+  struct
+  {
+    const char *name;
+    std::vector<uint8_t> archive;
+    bool corrupted;
+  } cases[] = {
+      {"valid", archive, false},
+      {"truncated", std::vector<uint8_t>(archive.begin(), archive.end() - 1), true},
+      {"tile past the archive end", with_field(archive, offsets_offset + sizeof(size_t), huge), true},
+      {"tile height 0", with_field(archive, tile_height_offset, 0), true},
+      {"tile height past the image", with_field(archive, tile_height_offset, height + 1), true},
+      {"tile height wrapping the tile count", with_field(archive, tile_height_offset, huge), true},
+      {"pixel bytes overflowing", with_field(archive, width_offset, huge / 2), true},
+      {"height overflowing", with_field(archive, height_offset, huge), true},
+      {"tile index past the archive end", with_size(archive, 1, tall, 1), true},
+      {"tile predictors past the archive end", with_automatic_tiles(archive), true},
+      {"more pixels than the tiles hold", with_size(archive, width, tall, tall), true},
+      {"more pixels than the range coder holds", with_size(range_archive, width, tall, tall), true},
+      {"valid predictor B", b_archive, false},
+      {"more pixels than the segments hold", with_size(b_archive, width, tall, tall), true},
+  };
+
+  int failures = 0;
+  for (const auto &c : cases)
+  {
+    if (rejected(c.archive) != c.corrupted)
+    {
+      std::cerr << c.name << ": " << (c.corrupted ? "accepted" : "rejected") << std::endl;
+      failures++;
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+// Every predictor, entropy coder, colour transform and tiling must give back
+// the exact image, and the same archive whatever the number of threads:
+//
+//   make check
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "compression.hpp"
+
+namespace
+{
+struct image
+{
+  size_t width;
+  size_t height;
+  std::vector<uint8_t> pixels;
+};
+
+// smooth gradients with some noise, and a flat band at the bottom, so that
+// every coder sees both small and large residuals and constant runs
+image test_image(size_t width, size_t height)
+{
+  image i{width, height, std::vector<uint8_t>(width * height * 3)};
+  unsigned noise = 1;
+  for (size_t y = 0; y < height; y++)
+  {
+    for (size_t x = 0; x < width; x++)
+    {
+      noise = noise * 1103515245 + 12345;
+      uint8_t *p = &i.pixels[(y * width + x) * 3];
+      const bool flat = y >= height - height / 4;
+      p[0] = flat ? 40 : uint8_t(x * 5 + y * 2 + (noise >> 28));
+      p[1] = flat ? 90 : uint8_t(x * y / 3 + (noise >> 29));
+      p[2] = flat ? 200 : uint8_t(255 - y * 4 + (noise >> 26));
+    }
+  }
+  return i;
+}
+
+std::vector<uint8_t> ppm(const image &i)
+{
+  const std::string header = "P6\n" + std::to_string(i.width) + " " + std::to_string(i.height) + "\n255\n";
+  std::vector<uint8_t> file(header.begin(), header.end());
+  file.insert(file.end(), i.pixels.begin(), i.pixels.end());
+  return file;
+}
+
+void write_file(const std::string &path, const std::vector<uint8_t> &bytes)
+{
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  if (!out)
+  {
+    throw std::runtime_error("can't write " + path);
+  }
+}
+
+std::vector<uint8_t> read_file(const std::string &path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int failures = 0;
+
+void fail(const std::string &name, const std::string &what)
+{
+  std::cerr << name << ": " << what << std::endl;
+  failures++;
+}
+
+std::string describe(const compression_settings &settings)
+{
+  return "predictor " + std::to_string(int(settings.predictor)) + ", entropy " +
+         std::to_string(int(settings.entropy)) + ", transform " + std::to_string(int(settings.transform)) +
+         ", bands " + std::to_string(settings.bands) + ", tiles " + std::to_string(settings.tiles);
+}
+
+// in memory, on 1, 2 and 4 threads
+void round_trip(const image &i, compression_settings settings)
+{
+  const std::string name = describe(settings) + ", " + std::to_string(i.width) + "x" + std::to_string(i.height);
+  std::vector<uint8_t> reference;
+  for (size_t threads : {1, 2, 4})
+  {
+    settings.threads = threads;
+    const std::vector<uint8_t> archive = compress_pixels(i.pixels.data(), i.width, i.height, 0, settings);
+    if (reference.empty())
+    {
+      reference = archive;
+    }
+    else if (archive != reference)
+    {
+      fail(name, "archive differs on " + std::to_string(threads) + " threads");
+    }
+
+    std::vector<uint8_t> decoded(i.pixels.size());
+    decompress_pixels(archive.data(), archive.size(), decoded.data(), 0, settings);
+    if (decoded != i.pixels)
+    {
+      fail(name, "decoded image differs on " + std::to_string(threads) + " threads");
+    }
+  }
+}
+
+// through files, row by row, decoded both as a stream and as a whole
+void stream_round_trip(const image &i, const compression_settings &settings, const std::string &directory)
+{
+  const std::string name = "stream, " + describe(settings);
+  const std::string input = directory + "/input.ppm";
+  const std::string archive = directory + "/archive.blp";
+  const std::string output = directory + "/output.ppm";
+  write_file(input, ppm(i));
+
+  compression_settings streaming = settings;
+  streaming.stream = true;
+  compress(input, archive, streaming);
+  const std::vector<uint8_t> bytes = read_file(archive);
+  const std::vector<uint8_t> expected = decompress_ppm(bytes.data(), bytes.size());
+
+  decompress(archive, output, streaming);
+  if (read_file(output) != expected)
+  {
+    fail(name, "stream decoding differs");
+  }
+  std::vector<uint8_t> decoded(i.pixels.size());
+  decompress_pixels(bytes.data(), bytes.size(), decoded.data(), 0);
+  if (decoded != i.pixels)
+  {
+    fail(name, "decoded image differs");
+  }
+
+  // predictor A streams the archive of a single tile
+  if (settings.predictor == predictor_type::A &&
+      bytes != compress_pixels(i.pixels.data(), i.width, i.height, 0, settings))
+  {
+    fail(name, "archive differs from the single tile one");
+  }
+
+  std::remove(input.c_str());
+  std::remove(archive.c_str());
+  std::remove(output.c_str());
+}
+} // namespace
+
+int main()
+{
+  const image images[] = {test_image(45, 37), test_image(1, 9), test_image(20, 1)};
+  const predictor_type predictors[] = {predictor_type::A, predictor_type::B, predictor_type::C, predictor_type::D,
+                                       predictor_type::automatic};
+  const entropy_type entropies[] = {entropy_type::huffman, entropy_type::range, entropy_type::context};
+  const colour_transform transforms[] = {colour_transform::none, colour_transform::rct, colour_transform::ycocg};
+
+  for (const auto &i : images)
+  {
+    for (auto predictor : predictors)
+    {
+      for (auto entropy : entropies)
+      {
+        if (entropy == entropy_type::context && predictor != predictor_type::A)
+        {
+          continue;
+        }
+        for (auto transform : transforms)
+        {
+          for (size_t tiles : {1, 3})
+          {
+            for (size_t bands : {1, 3})
+            {
+              compression_settings settings;
+              settings.predictor = predictor;
+              settings.entropy = entropy;
+              settings.transform = transform;
+              settings.tiles = tiles;
+              settings.bands = bands;
+              round_trip(i, settings);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  const char *tmp = std::getenv("TMPDIR");
+  std::string directory = std::string(tmp ? tmp : "/tmp") + "/round_trip.XXXXXX";
+  if (!mkdtemp(&directory[0]))
+  {
+    std::cerr << "can't create " << directory << std::endl;
+    return 1;
+  }
+  for (auto predictor : {predictor_type::A, predictor_type::C, predictor_type::D})
+  {
+    for (auto entropy : entropies)
+    {
+      if (entropy == entropy_type::context && predictor != predictor_type::A)
+      {
+        continue;
+      }
+      compression_settings settings;
+      settings.predictor = predictor;
+      settings.entropy = entropy;
+      settings.transform = colour_transform::ycocg;
+      settings.bands = 2;
+      settings.threads = 1;
+      stream_round_trip(images[0], settings, directory);
+    }
+  }
+  rmdir(directory.c_str());
+
+  return failures ? 1 : 0;
+}